@@ -19,7 +19,9 @@
 
 /*  This example shows how to set up a term structure and then price
     some simple bonds. The last part is dedicated to peripherical
-    computations such as "Yield to Price" or "Price to Yield"
+    computations such as "Yield to Price" or "Price to Yield".
+    Optional benchmarks are selected from the command line, see the
+    BENCHMARKING section below.
  */
 
 #include <ql/qldefines.hpp>
@@ -28,8 +30,14 @@
 #endif
 #include <ql/instruments/bonds/zerocouponbond.hpp>
 #include <ql/instruments/bonds/floatingratebond.hpp>
+#include <ql/instruments/bonds/amortizingfixedratebond.hpp>
+#include <ql/instruments/bonds/amortizingfloatingratebond.hpp>
+#include <ql/experimental/callablebonds/callablebond.hpp>
+#include <ql/experimental/callablebonds/treecallablebondengine.hpp>
+#include <ql/models/shortrate/onefactormodels/hullwhite.hpp>
 #include <ql/pricingengines/bond/discountingbondengine.hpp>
 #include <ql/cashflows/couponpricer.hpp>
+#include <ql/cashflows/capflooredcoupon.hpp>
 #include <ql/termstructures/yield/piecewiseyieldcurve.hpp>
 #include <ql/termstructures/yield/bondhelpers.hpp>
 #include <ql/termstructures/volatility/optionlet/constantoptionletvol.hpp>
@@ -41,11 +49,38 @@
 #include <ql/time/daycounters/actual360.hpp>
 #include <ql/time/daycounters/thirty360.hpp>
 #include <ql/time/calendars/israel.hpp>
+#include <ql/patterns/singleton.hpp>
+#include <ql/math/matrix.hpp>
+#include <ql/utilities/null_deleter.hpp>
 
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <ctime>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace QuantLib;
 using namespace std;
@@ -122,8 +157,2656 @@ Month enumReversMapMonth(int month)
 
 //postcondition: Date is displayed in word format 
 
+/*********************
+ ***  BENCHMARKING ***
+ *********************/
 
-int main(int, char* []) {
+// Command line switches are of the form --name or --name=value; the
+// benchmarks below are only run when explicitly requested so that the
+// default output of the example is unchanged.
+
+bool hasOption(int argc, char* argv[], const std::string& name) {
+    for (int i=1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == name || arg.compare(0, name.size()+1, name + "=") == 0)
+            return true;
+    }
+    return false;
+}
+
+Size optionValue(int argc, char* argv[], const std::string& name,
+                 Size defaultValue) {
+    for (int i=1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, name.size()+1, name + "=") == 0)
+            return Size(std::strtoul(arg.c_str() + name.size() + 1,
+                                     nullptr, 10));
+    }
+    return defaultValue;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Resident set size of the calling process as reported by
+// /proc/self/statm, or -1 if it is not available.
+long residentKb() {
+    std::ifstream in("/proc/self/statm");
+    long pages = 0, resident = 0;
+    if (!(in >> pages >> resident))
+        return -1;
+    return resident * (::sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Outstanding notionals of a level-payment (annuity) loan: the same
+// payment covers interest and principal in every period.
+std::vector<Real> annuityNotionals(Real faceAmount, Rate rate,
+                                   Frequency frequency, Size periods) {
+    Rate r = rate / Integer(frequency);
+    Real payment = faceAmount * r / (1.0 - std::pow(1.0 + r, -Real(periods)));
+    std::vector<Real> notionals;
+    notionals.reserve(periods);
+    Real balance = faceAmount;
+    for (Size i=0; i<periods; ++i) {
+        notionals.push_back(balance);
+        balance = balance * (1.0 + r) - payment;
+    }
+    return notionals;
+}
+
+// A synthetic portfolio of monthly amortizing bonds paying on the 15th
+// of the month on the Israeli calendar; issue dates and tenors cycle so
+// that the bonds share the same payment-date grid.
+std::vector<ext::shared_ptr<Bond> > makeBenchmarkBonds(Size numberOfBonds,
+                                                       const Date& settlementDate,
+                                                       Natural settlementDays) {
+    std::vector<ext::shared_ptr<Bond> > bonds;
+    bonds.reserve(numberOfBonds);
+    Calendar calendar = Israel();
+    Date firstIssue(15, settlementDate.month(), settlementDate.year() - 2);
+    for (Size i=0; i<numberOfBonds; ++i) {
+        Date issueDate = firstIssue + Period(Integer(i % 24), Months);
+        Integer years = 5 + Integer(i % 26);
+        Rate coupon = 0.03 + 0.0025 * Real(i % 13);
+        Schedule schedule(issueDate, issueDate + Period(years, Years),
+                          Period(Monthly), calendar,
+                          Following, Following,
+                          DateGeneration::Forward, false);
+        bonds.push_back(ext::make_shared<AmortizingFixedRateBond>(
+                settlementDays,
+                annuityNotionals(100.0, coupon, Monthly, schedule.size()-1),
+                schedule,
+                std::vector<Rate>(1, coupon),
+                Thirty360(Thirty360::BondBasis),
+                Following,
+                issueDate));
+    }
+    return bonds;
+}
+
+
+/**************************
+ ***  DISCOUNT CACHING  ***
+ **************************/
+
+//! Discount curve decorator caching discount factors on a daily grid
+/*! Discount factors of the underlying curve are filled in blocks of
+    consecutive days on first use, so that repeated queries on the
+    same payment dates reduce to an array lookup.  Times are measured
+    with Actual/365 (Fixed) so that each date maps exactly onto a day
+    of the grid; the cache is dropped whenever the underlying curve
+    notifies a change.
+
+    \warning the cache is not thread-safe.
+*/
+class CachedDiscountCurve : public YieldTermStructure {
+  public:
+    explicit CachedDiscountCurve(Handle<YieldTermStructure> curve,
+                                 Size blockSize = 64)
+    : YieldTermStructure(Actual365Fixed()), curve_(std::move(curve)),
+      blockSize_(blockSize) {
+        registerWith(curve_);
+    }
+    //! \name TermStructure interface
+    //@{
+    const Date& referenceDate() const override {
+        return curve_->referenceDate();
+    }
+    Date maxDate() const override { return curve_->maxDate(); }
+    Calendar calendar() const override { return curve_->calendar(); }
+    Natural settlementDays() const override {
+        return curve_->settlementDays();
+    }
+    //@}
+    //! \name Observer interface
+    //@{
+    void update() override {
+        grid_.clear();
+        filled_.clear();
+        ++version_;
+        YieldTermStructure::update();
+    }
+    //@}
+    //! \name Statistics
+    //@{
+    Size lookups() const { return lookups_; }
+    Size hits() const { return hits_; }
+    Size blockFills() const { return blockFills_; }
+    Real hitRate() const {
+        return lookups_ == 0 ? 0.0 : Real(hits_) / Real(lookups_);
+    }
+    //! incremented each time the cache is invalidated
+    Size version() const { return version_; }
+    void resetStatistics() { lookups_ = hits_ = blockFills_ = 0; }
+    //@}
+  protected:
+    DiscountFactor discountImpl(Time t) const override {
+        Real days = t * 365.0;
+        Real lower = std::floor(days + 1.0e-9);
+        Real w = days - lower;
+        Integer n = Integer(lower);
+        if (std::fabs(w) < 1.0e-9)
+            return dayDiscount(n);
+        // intraday times are never produced by date-based queries;
+        // interpolate log-linearly between the enclosing days.
+        return std::pow(dayDiscount(n), 1.0 - w) *
+               std::pow(dayDiscount(n + 1), w);
+    }
+  private:
+    DiscountFactor dayDiscount(Integer n) const {
+        ++lookups_;
+        if (grid_.empty()) {
+            Size horizon = Size(curve_->maxDate() - referenceDate()) + 1;
+            grid_.resize(horizon);
+            filled_.assign((horizon + blockSize_ - 1) / blockSize_, false);
+        }
+        if (n < 0 || Size(n) >= grid_.size())
+            return curve_->discount(referenceDate() + n, true);
+        Size block = Size(n) / blockSize_;
+        if (filled_[block]) {
+            ++hits_;
+        } else {
+            Date start = referenceDate() + Integer(block * blockSize_);
+            Size end = std::min(grid_.size(), (block + 1) * blockSize_);
+            for (Size i=block*blockSize_; i<end; ++i)
+                grid_[i] = curve_->discount(
+                    start + Integer(i - block*blockSize_), true);
+            filled_[block] = true;
+            ++blockFills_;
+        }
+        return grid_[n];
+    }
+    Handle<YieldTermStructure> curve_;
+    Size blockSize_;
+    mutable std::vector<DiscountFactor> grid_;
+    mutable std::vector<bool> filled_;
+    mutable Size lookups_ = 0, hits_ = 0, blockFills_ = 0;
+    Size version_ = 0;
+};
+
+// Prices the portfolio repeatedly with a DiscountingBondEngine on the
+// given curve, and again on the same curve wrapped in the cache.
+void benchmarkDiscountCache(const std::vector<ext::shared_ptr<Bond> >& bonds,
+                            const Handle<YieldTermStructure>& curve,
+                            Size iterations) {
+    ext::shared_ptr<CachedDiscountCurve> cachedCurve(
+        new CachedDiscountCurve(curve));
+    ext::shared_ptr<PricingEngine> engines[] = {
+        ext::make_shared<DiscountingBondEngine>(curve),
+        ext::make_shared<DiscountingBondEngine>(
+            Handle<YieldTermStructure>(cachedCurve))
+    };
+    const char* labels[] = { "plain curve", "cached curve" };
+
+    std::vector<Real> npvs[2];
+    double elapsed[2];
+    for (Size k=0; k<2; ++k) {
+        for (const auto& bond : bonds)
+            bond->setPricingEngine(engines[k]);
+        npvs[k].resize(bonds.size());
+        auto start = std::chrono::steady_clock::now();
+        for (Size it=0; it<iterations; ++it) {
+            for (Size i=0; i<bonds.size(); ++i) {
+                bonds[i]->recalculate();
+                npvs[k][i] = bonds[i]->NPV();
+            }
+        }
+        elapsed[k] = secondsSince(start);
+    }
+
+    Real maxDifference = 0.0;
+    for (Size i=0; i<bonds.size(); ++i)
+        maxDifference = std::max(maxDifference,
+                                 std::fabs(npvs[0][i] - npvs[1][i]));
+
+    Size pricings = bonds.size() * iterations;
+    std::cout << std::endl;
+    std::cout << "Discount cache benchmark: " << bonds.size() << " bonds x "
+              << iterations << " iterations" << std::endl;
+    for (Size k=0; k<2; ++k)
+        std::cout << std::setw(14) << labels[k] << ": "
+                  << std::setprecision(0) << Real(pricings) / elapsed[k]
+                  << " NPV/s" << std::endl;
+    std::cout << std::setprecision(2)
+              << "       speed-up: " << elapsed[0] / elapsed[1] << "x"
+              << std::endl;
+    std::cout << "       hit rate: " << io::percent(cachedCurve->hitRate())
+              << " (" << cachedCurve->lookups() << " lookups, "
+              << cachedCurve->blockFills() << " block fills)" << std::endl;
+    std::cout << std::scientific
+              << " max NPV change: " << maxDifference
+              << std::fixed << std::endl;
+}
+
+/**********************
+ ***  FIXING STORE  ***
+ **********************/
+
+//! Read-only columnar store of daily index fixings
+/*! The store is backed by a memory-mapped binary file holding one
+    column per index.  Each column covers a contiguous range of days
+    starting from its first date, with Null<Real>() on days without a
+    fixing, so that a lookup is a subtraction and an array read.  Once
+    opened the store is never modified and can be shared across
+    threads.
+
+    File layout (native byte order):
+    - header: 8-byte magic, 8-byte number of columns;
+    - one 72-byte directory entry per column: 48-byte zero-padded
+      index name, first serial number, number of days, byte offset
+      of the values;
+    - the values of each column as contiguous doubles.
+*/
+class FixingStore {
+  public:
+    struct Column {
+        std::string name;
+        Date::serial_type firstSerial;
+        Size days;
+        const Real* values;
+    };
+    explicit FixingStore(const std::string& fileName) {
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        QL_REQUIRE(fd >= 0, "unable to open fixing file " << fileName);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            QL_FAIL("unable to stat fixing file " << fileName);
+        }
+        bytes_ = Size(info.st_size);
+        void* data = bytes_ > 0 ?
+            ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0) :
+            MAP_FAILED;
+        ::close(fd);
+        QL_REQUIRE(data != MAP_FAILED, "unable to map fixing file " << fileName);
+        data_ = static_cast<const char*>(data);
+        // the destructor won't run if the contents are rejected
+        try {
+            readDirectory(fileName);
+        } catch (...) {
+            ::munmap(data, bytes_);
+            throw;
+        }
+    }
+    ~FixingStore() {
+        ::munmap(const_cast<char*>(data_), bytes_);
+    }
+    FixingStore(const FixingStore&) = delete;
+    FixingStore& operator=(const FixingStore&) = delete;
+
+    //! index of the column holding the fixings of the given index name
+    Size column(const std::string& name) const {
+        for (Size i=0; i<columns_.size(); ++i)
+            if (columns_[i].name == name)
+                return i;
+        QL_FAIL("no fixings stored for " << name);
+    }
+    bool hasColumn(const std::string& name) const {
+        for (const auto& c : columns_)
+            if (c.name == name)
+                return true;
+        return false;
+    }
+    //! fixing on the given date, or Null<Real>() if not available
+    Real fixing(Size column, const Date& d) const {
+        const Column& c = columns_[column];
+        // dates before the first one wrap around to large offsets
+        Size i = Size(d.serialNumber() - c.firstSerial);
+        return i < c.days ? c.values[i] : Null<Real>();
+    }
+    const std::vector<Column>& columns() const { return columns_; }
+    //! size of the mapped file
+    Size bytes() const { return bytes_; }
+
+    //! writes columns of daily values starting at the given dates
+    static void write(const std::string& fileName,
+                      const std::vector<std::string>& names,
+                      const std::vector<Date>& firstDates,
+                      const std::vector<std::vector<Real> >& values) {
+        QL_REQUIRE(names.size() == firstDates.size() &&
+                   names.size() == values.size(),
+                   "mismatched fixing columns");
+        std::ofstream out(fileName.c_str(), std::ios::binary);
+        QL_REQUIRE(out, "unable to create fixing file " << fileName);
+        std::uint64_t n = names.size();
+        out.write(magic, sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        std::uint64_t offset = headerSize + n * entrySize;
+        for (Size i=0; i<names.size(); ++i) {
+            QL_REQUIRE(names[i].size() < nameSize,
+                       "index name too long: " << names[i]);
+            char name[nameSize] = {};
+            std::memcpy(name, names[i].data(), names[i].size());
+            std::int64_t first = firstDates[i].serialNumber();
+            std::uint64_t days = values[i].size();
+            out.write(name, nameSize);
+            out.write(reinterpret_cast<const char*>(&first), 8);
+            out.write(reinterpret_cast<const char*>(&days), 8);
+            out.write(reinterpret_cast<const char*>(&offset), 8);
+            offset += days * sizeof(Real);
+        }
+        for (const auto& column : values)
+            out.write(reinterpret_cast<const char*>(column.data()),
+                      std::streamsize(column.size() * sizeof(Real)));
+        QL_REQUIRE(out, "error writing fixing file " << fileName);
+    }
+
+  private:
+    // Sizes and offsets come from the file and are only compared
+    // after division, so that a corrupted header can't overflow them.
+    void readDirectory(const std::string& fileName) {
+        QL_REQUIRE(bytes_ >= headerSize &&
+                   std::memcmp(data_, magic, sizeof(magic)) == 0,
+                   fileName << " is not a fixing file");
+        std::uint64_t n;
+        std::memcpy(&n, data_ + sizeof(magic), sizeof(n));
+        QL_REQUIRE(n <= (bytes_ - headerSize) / entrySize,
+                   "truncated fixing file " << fileName);
+        columns_.reserve(n);
+        for (std::uint64_t i=0; i<n; ++i) {
+            const char* entry = data_ + headerSize + i * entrySize;
+            std::int64_t first;
+            std::uint64_t days, offset;
+            std::memcpy(&first, entry + nameSize, 8);
+            std::memcpy(&days, entry + nameSize + 8, 8);
+            std::memcpy(&offset, entry + nameSize + 16, 8);
+            QL_REQUIRE(offset % sizeof(Real) == 0 && offset <= bytes_ &&
+                       days <= (bytes_ - offset) / sizeof(Real),
+                       "corrupted fixing file " << fileName);
+            Column c = {
+                std::string(entry, strnlen(entry, nameSize)),
+                Date::serial_type(first), Size(days),
+                reinterpret_cast<const Real*>(data_ + offset)
+            };
+            columns_.push_back(c);
+        }
+    }
+
+    static constexpr char magic[8] = { 'Q','L','F','I','X','0','1','\0' };
+    static constexpr Size nameSize = 48;
+    static constexpr Size headerSize = 16;
+    static constexpr Size entrySize = nameSize + 24;
+    const char* data_ = nullptr;
+    Size bytes_ = 0;
+    std::vector<Column> columns_;
+};
+
+constexpr char FixingStore::magic[8];
+
+//! Ibor index reading its past fixings from a FixingStore
+/*! Fixings missing from the store are looked up in the usual
+    IndexManager history, so that fixings added manually with
+    addFixing() are still honored.  Date calculations and forecasts
+    are forwarded to the wrapped index, so that indexes overriding
+    them (e.g. Libor and its joint calendar) behave as they would
+    without the store.
+*/
+class StoredFixingIborIndex : public IborIndex {
+  public:
+    StoredFixingIborIndex(const ext::shared_ptr<IborIndex>& index,
+                          ext::shared_ptr<const FixingStore> store,
+                          const Handle<YieldTermStructure>& h =
+                                                Handle<YieldTermStructure>())
+    : IborIndex(index->familyName(), index->tenor(), index->fixingDays(),
+                index->currency(), index->fixingCalendar(),
+                index->businessDayConvention(), index->endOfMonth(),
+                index->dayCounter(), h),
+      index_(index->clone(h)), store_(std::move(store)),
+      column_(store_->column(index->name())) {}
+    Rate pastFixing(const Date& fixingDate) const override {
+        Real result = store_->fixing(column_, fixingDate);
+        return result != Null<Real>() ? result :
+                                        IborIndex::pastFixing(fixingDate);
+    }
+    Date valueDate(const Date& fixingDate) const override {
+        return index_->valueDate(fixingDate);
+    }
+    Date maturityDate(const Date& valueDate) const override {
+        return index_->maturityDate(valueDate);
+    }
+    using IborIndex::forecastFixing;
+    Rate forecastFixing(const Date& fixingDate) const override {
+        return index_->forecastFixing(fixingDate);
+    }
+    ext::shared_ptr<IborIndex>
+    clone(const Handle<YieldTermStructure>& h) const override {
+        return ext::make_shared<StoredFixingIborIndex>(index_, store_, h);
+    }
+  private:
+    ext::shared_ptr<IborIndex> index_;
+    ext::shared_ptr<const FixingStore> store_;
+    Size column_;
+};
+
+// Synthetic daily history for the given index between two dates;
+// days that are not fixing dates hold Null<Real>().
+std::vector<Real> syntheticFixings(const IborIndex& index,
+                                   const Date& from, const Date& to,
+                                   Real phase) {
+    std::vector<Real> values;
+    values.reserve(Size(to - from) + 1);
+    for (Date d = from; d <= to; ++d) {
+        if (index.isValidFixingDate(d))
+            values.push_back(0.03 + 0.02 * std::sin(d.serialNumber() / 700.0
+                                                    + phase));
+        else
+            values.push_back(Null<Real>());
+    }
+    return values;
+}
+
+// Compares the fixing store against the IndexManager histories filled
+// by addFixings(), then prices an amortizing floater on stored fixings.
+void benchmarkFixingStore(const ext::shared_ptr<IborIndex>& libor,
+                          const Handle<YieldTermStructure>& discountCurve,
+                          const Date& settlementDate,
+                          Natural settlementDays,
+                          Size lookups, Size threads) {
+    Date today = Settings::instance().evaluationDate();
+    Date from(2, January, 1975);
+    std::vector<ext::shared_ptr<IborIndex> > indexes = {
+        ext::make_shared<Euribor1M>(), ext::make_shared<Euribor3M>(),
+        ext::make_shared<Euribor6M>(), ext::make_shared<Euribor1Y>(),
+        ext::make_shared<USDLibor>(Period(1, Months)),
+        ext::make_shared<USDLibor>(Period(6, Months)),
+        ext::make_shared<USDLibor>(Period(1, Years)),
+        libor
+    };
+    std::vector<std::string> names;
+    std::vector<Date> firstDates;
+    std::vector<std::vector<Real> > values;
+    for (Size i=0; i<indexes.size(); ++i) {
+        names.push_back(indexes[i]->name());
+        firstDates.push_back(from);
+        values.push_back(syntheticFixings(*indexes[i], from, today - 1,
+                                          Real(i)));
+    }
+    // the stored history agrees with the fixing used in the example
+    values.back()[Size(Date(17, July, 2008) - from)] = 0.0278625;
+
+    const std::string fileName = "bonds2_fixings.bin";
+    FixingStore::write(fileName, names, firstDates, values);
+
+    // bulk loading: memory-mapped store vs addFixings() into the
+    // IndexManager; the example's own index is left untouched.  The
+    // store is read through once so that its pages are actually
+    // mapped in, and the memory of both is measured as the growth of
+    // the resident set.
+    const Size mapped = indexes.size() - 1;
+    long residentBefore = residentKb();
+    auto start = std::chrono::steady_clock::now();
+    ext::shared_ptr<const FixingStore> store(new FixingStore(fileName));
+    Real loadSum = 0.0;
+    for (const auto& c : store->columns())
+        for (Size j=0; j<c.days; ++j)
+            if (c.values[j] != Null<Real>())
+                loadSum += c.values[j];
+    double storeLoad = secondsSince(start);
+    long storeResident = residentKb() - residentBefore;
+
+    std::vector<std::vector<Date> > fixingDates(mapped);
+    std::vector<std::vector<Real> > fixings(mapped);
+    Size totalFixings = 0;
+    Real fixingSum = 0.0;
+    for (Size i=0; i<mapped; ++i) {
+        for (Size j=0; j<values[i].size(); ++j) {
+            if (values[i][j] != Null<Real>()) {
+                fixingDates[i].push_back(from + Integer(j));
+                fixings[i].push_back(values[i][j]);
+                fixingSum += values[i][j];
+            }
+        }
+        totalFixings += fixings[i].size();
+    }
+    // the example's own index is stored last, see above
+    for (Size j=0; j<values[mapped].size(); ++j)
+        if (values[mapped][j] != Null<Real>())
+            fixingSum += values[mapped][j];
+    residentBefore = residentKb();
+    start = std::chrono::steady_clock::now();
+    for (Size i=0; i<mapped; ++i)
+        indexes[i]->addFixings(fixingDates[i].begin(), fixingDates[i].end(),
+                               fixings[i].begin(), true);
+    double mapLoad = secondsSince(start);
+    long mapResident = residentKb() - residentBefore;
+
+    // random lookups on valid fixing dates, same sequence for both
+    std::vector<std::pair<Size, Date> > queries(lookups);
+    unsigned long long seed = 42;
+    for (auto& q : queries) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        Size i = Size(seed >> 33) % mapped;
+        q = { i, fixingDates[i][Size(seed >> 11) % fixingDates[i].size()] };
+    }
+    std::vector<Size> columns(mapped);
+    for (Size i=0; i<mapped; ++i)
+        columns[i] = store->column(names[i]);
+
+    Real mapSum = 0.0, storeSum = 0.0, indexSum = 0.0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& q : queries)
+        mapSum += indexes[q.first]->fixing(q.second);
+    double mapLookup = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& q : queries)
+        storeSum += store->fixing(columns[q.first], q.second);
+    double storeLookup = secondsSince(start);
+
+    std::vector<ext::shared_ptr<IborIndex> > storedIndexes;
+    for (Size i=0; i<mapped; ++i)
+        storedIndexes.push_back(
+            ext::make_shared<StoredFixingIborIndex>(indexes[i], store));
+    start = std::chrono::steady_clock::now();
+    for (const auto& q : queries)
+        indexSum += storedIndexes[q.first]->fixing(q.second);
+    double indexLookup = secondsSince(start);
+
+    // the same lookups split across threads sharing the store
+    std::vector<Real> partialSums(threads, 0.0);
+    start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::thread> workers;
+        for (Size t=0; t<threads; ++t) {
+            workers.emplace_back([&, t]() {
+                Real sum = 0.0;
+                for (Size k=t; k<queries.size(); k+=threads)
+                    sum += store->fixing(columns[queries[k].first],
+                                         queries[k].second);
+                partialSums[t] = sum;
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+    }
+    double threadedLookup = secondsSince(start);
+
+    for (Size i=0; i<mapped; ++i)
+        IndexManager::instance().clearHistory(indexes[i]->name());
+
+    std::cout << std::endl;
+    std::cout << "Fixing store benchmark: " << mapped << " indexes, "
+              << totalFixings << " fixings, " << lookups << " lookups"
+              << std::endl;
+    std::cout << std::setprecision(3)
+              << "          load: mapped file and full scan "
+              << storeLoad * 1000.0 << " ms, addFixings "
+              << mapLoad * 1000.0 << " ms" << std::endl;
+    std::cout << std::setprecision(0)
+              << "  resident growth/index: mapped store "
+              << Real(storeResident) / store->columns().size()
+              << " kB, addFixings histories "
+              << Real(mapResident) / mapped << " kB" << std::endl;
+    std::cout << "  lookups/s: addFixing history "
+              << Real(lookups) / mapLookup << ", stored index "
+              << Real(lookups) / indexLookup << ", raw store "
+              << Real(lookups) / storeLookup << ", raw store x" << threads
+              << " threads " << Real(lookups) / threadedLookup << std::endl;
+    Real threadedSum = 0.0;
+    for (Real s : partialSums)
+        threadedSum += s;
+    std::cout << std::scientific << std::setprecision(2)
+              << "  checksum differences: "
+              << std::fabs(storeSum - mapSum) << ", "
+              << std::fabs(indexSum - mapSum) << ", "
+              << std::fabs(threadedSum - storeSum) << ", "
+              << std::fabs(loadSum - fixingSum)
+              << std::fixed << std::endl;
+
+    // An amortizing floater issued long before the evaluation date:
+    // its current coupon fixed in the past and is read from the store.
+    ext::shared_ptr<IborIndex> storedLibor =
+        ext::make_shared<StoredFixingIborIndex>(
+            libor, store, libor->forwardingTermStructure());
+    Date issueDate(21, October, 2003);
+    Schedule schedule(issueDate, Date(21, October, 2023), Period(Quarterly),
+                      UnitedStates(UnitedStates::NYSE),
+                      Unadjusted, Unadjusted, DateGeneration::Backward, true);
+    AmortizingFloatingRateBond amortizingFloater(
+            settlementDays,
+            annuityNotionals(100.0, 0.04, Quarterly, schedule.size()-1),
+            schedule,
+            storedLibor,
+            Actual360(),
+            ModifiedFollowing,
+            Natural(2),
+            std::vector<Real>(1, 1.0),
+            std::vector<Spread>(1, 0.001),
+            std::vector<Rate>(),
+            std::vector<Rate>(),
+            false,
+            issueDate);
+    amortizingFloater.setPricingEngine(
+        ext::make_shared<DiscountingBondEngine>(discountCurve));
+    setCouponPricer(amortizingFloater.cashflows(),
+                    ext::make_shared<BlackIborCouponPricer>());
+    std::cout << std::setprecision(4)
+              << "  amortizing floater: notional "
+              << amortizingFloater.notional(settlementDate)
+              << ", NPV " << amortizingFloater.NPV()
+              << ", current coupon " << io::rate(
+                     amortizingFloater.nextCouponRate(settlementDate))
+              << std::endl;
+
+    std::remove(fileName.c_str());
+}
+
+/************************
+ ***  FLAT PORTFOLIO  ***
+ ************************/
+
+//! Log-linear discount interpolation over externally owned nodes
+/*! The view reproduces PiecewiseYieldCurve<Discount,LogLinear> on the
+    given node times and log-discounts, including its extrapolation
+    past the last node, without any observer or handle machinery; it
+    can therefore point into shared memory and be used from several
+    threads or processes at once.
+*/
+struct DiscountCurveView {
+    const Time* times;
+    const Real* logDiscounts;
+    Size size;
+    DiscountFactor discount(Time t) const {
+        Size i = std::upper_bound(times + 1, times + size - 1, t) - times - 1;
+        Real slope = (logDiscounts[i+1] - logDiscounts[i]) /
+                     (times[i+1] - times[i]);
+        return std::exp(logDiscounts[i] + slope * (t - times[i]));
+    }
+};
+
+//! Owning copy of the nodes of a bootstrapped curve
+struct CurveNodes {
+    std::vector<Time> times;
+    std::vector<Real> logDiscounts;
+    DiscountCurveView view() const {
+        DiscountCurveView v = { times.data(), logDiscounts.data(),
+                                times.size() };
+        return v;
+    }
+};
+
+CurveNodes curveNodes(const ext::shared_ptr<YieldTermStructure>& curve) {
+    ext::shared_ptr<PiecewiseYieldCurve<Discount,LogLinear> > piecewise =
+        ext::dynamic_pointer_cast<PiecewiseYieldCurve<Discount,LogLinear> >(
+                                                                      curve);
+    QL_REQUIRE(piecewise, "log-linear discount curve required");
+    CurveNodes nodes;
+    nodes.times = piecewise->times();
+    const std::vector<Real>& discounts = piecewise->data();
+    nodes.logDiscounts.reserve(discounts.size());
+    for (Real d : discounts)
+        nodes.logDiscounts.push_back(std::log(d));
+    return nodes;
+}
+
+//! Cash flows of a bond portfolio flattened into contiguous arrays
+/*! Cash flows are stored once per distinct bond; each position refers
+    to a range of them and scales it by its face amount.  Ibor coupons
+    that are not fixed yet keep their forecasting period so that their
+    amount can be recomputed on any forecasting curve.  Times are
+    measured from the reference date of the curves the portfolio was
+    built against.
+*/
+struct FlatPortfolio {
+    // positions
+    std::vector<Size> begin, end;
+    std::vector<Real> scale;
+    // cash flows
+    std::vector<Time> payTimes;
+    std::vector<Real> amounts;            // fixed part of the amount
+    std::vector<Real> floatingNotionals;  // nominal x accrual x gearing
+    std::vector<Time> fixingStarts, fixingEnds;
+    std::vector<Time> spanningTimes;
+
+    Size size() const { return begin.size(); }
+
+    //! appends the live cash flows of a bond; returns their range
+    std::pair<Size, Size> addCashflows(const Bond& bond,
+                                       const YieldTermStructure& discountCurve,
+                                       const YieldTermStructure& forecastCurve) {
+        Date referenceDate = discountCurve.referenceDate();
+        Date today = Settings::instance().evaluationDate();
+        Size first = payTimes.size();
+        for (const auto& cf : bond.cashflows()) {
+            if (cf->hasOccurred(referenceDate, false))
+                continue;
+            payTimes.push_back(discountCurve.timeFromReference(cf->date()));
+            ext::shared_ptr<IborCoupon> coupon =
+                ext::dynamic_pointer_cast<IborCoupon>(cf);
+            if (coupon && coupon->fixingDate() > today) {
+                Real notional = coupon->nominal() * coupon->accrualPeriod();
+                amounts.push_back(notional * coupon->spread());
+                floatingNotionals.push_back(notional * coupon->gearing());
+                fixingStarts.push_back(forecastCurve.timeFromReference(
+                                                coupon->fixingValueDate()));
+                fixingEnds.push_back(forecastCurve.timeFromReference(
+                                                coupon->fixingEndDate()));
+                spanningTimes.push_back(coupon->spanningTime());
+            } else {
+                amounts.push_back(cf->amount());
+                floatingNotionals.push_back(0.0);
+                fixingStarts.push_back(0.0);
+                fixingEnds.push_back(0.0);
+                spanningTimes.push_back(1.0);
+            }
+        }
+        return std::make_pair(first, payTimes.size());
+    }
+    void addPosition(const std::pair<Size, Size>& cashflows, Real s) {
+        begin.push_back(cashflows.first);
+        end.push_back(cashflows.second);
+        scale.push_back(s);
+    }
+    //! value at the reference date of the curves
+    Real npv(Size position,
+             const DiscountCurveView& discountCurve,
+             const DiscountCurveView& forecastCurve) const {
+        Real result = 0.0;
+        for (Size j=begin[position]; j<end[position]; ++j) {
+            Real amount = amounts[j];
+            if (floatingNotionals[j] != 0.0) {
+                Rate forward =
+                    (forecastCurve.discount(fixingStarts[j]) /
+                     forecastCurve.discount(fixingEnds[j]) - 1.0) /
+                    spanningTimes[j];
+                amount += floatingNotionals[j] * forward;
+            }
+            result += amount * discountCurve.discount(payTimes[j]);
+        }
+        return scale[position] * result;
+    }
+};
+
+// Quarterly 3M Libor floaters starting at settlement, with maturities
+// cycling between 2 and 15 years.
+std::vector<ext::shared_ptr<Bond> > makeBenchmarkFloaters(
+                                    Size numberOfBonds,
+                                    const Date& settlementDate,
+                                    Natural settlementDays,
+                                    const ext::shared_ptr<IborIndex>& index) {
+    std::vector<ext::shared_ptr<Bond> > bonds;
+    bonds.reserve(numberOfBonds);
+    ext::shared_ptr<IborCouponPricer> pricer(new BlackIborCouponPricer);
+    for (Size i=0; i<numberOfBonds; ++i) {
+        Schedule schedule(settlementDate,
+                          settlementDate + Period(2 + Integer(i % 14), Years),
+                          Period(Quarterly), UnitedStates(UnitedStates::NYSE),
+                          ModifiedFollowing, ModifiedFollowing,
+                          DateGeneration::Backward, false);
+        ext::shared_ptr<FloatingRateBond> bond(new FloatingRateBond(
+                settlementDays,
+                100.0,
+                schedule,
+                index,
+                Actual360(),
+                ModifiedFollowing,
+                Natural(2),
+                std::vector<Real>(1, 1.0),
+                std::vector<Spread>(1, 0.0005 * Real(i % 5))));
+        setCouponPricer(bond->cashflows(), pricer);
+        bonds.push_back(bond);
+    }
+    return bonds;
+}
+
+// Flattens a set of distinct bonds and fills the portfolio with
+// positions cycling through them at varying face amounts.
+FlatPortfolio makeFlatPortfolio(Size numberOfPositions,
+                                const std::vector<ext::shared_ptr<Bond> >& bonds,
+                                const YieldTermStructure& discountCurve,
+                                const YieldTermStructure& forecastCurve) {
+    FlatPortfolio portfolio;
+    std::vector<std::pair<Size, Size> > ranges;
+    for (const auto& bond : bonds)
+        ranges.push_back(portfolio.addCashflows(*bond, discountCurve,
+                                                forecastCurve));
+    portfolio.begin.reserve(numberOfPositions);
+    portfolio.end.reserve(numberOfPositions);
+    portfolio.scale.reserve(numberOfPositions);
+    for (Size i=0; i<numberOfPositions; ++i)
+        portfolio.addPosition(ranges[i % ranges.size()],
+                              1.0 + Real(i % 7));
+    return portfolio;
+}
+
+// The distinct bonds of the portfolio-wide benchmarks: 312 amortizing
+// bonds and 70 floaters on the given index.
+std::vector<ext::shared_ptr<Bond> > makeBenchmarkPortfolioBonds(
+                                    const Date& settlementDate,
+                                    Natural settlementDays,
+                                    const ext::shared_ptr<IborIndex>& index) {
+    std::vector<ext::shared_ptr<Bond> > bonds =
+        makeBenchmarkBonds(312, settlementDate, settlementDays);
+    std::vector<ext::shared_ptr<Bond> > floaters =
+        makeBenchmarkFloaters(70, settlementDate, settlementDays, index);
+    bonds.insert(bonds.end(), floaters.begin(), floaters.end());
+    return bonds;
+}
+
+// Largest difference between the flattened prices of the first
+// positions and the DiscountingBondEngine prices of their bonds.
+Real maxFlatPricingError(const FlatPortfolio& portfolio,
+                         const std::vector<ext::shared_ptr<Bond> >& bonds,
+                         const Handle<YieldTermStructure>& discountCurve,
+                         const DiscountCurveView& discountNodes,
+                         const DiscountCurveView& forecastNodes) {
+    ext::shared_ptr<PricingEngine> engine(
+        new DiscountingBondEngine(discountCurve));
+    Real error = 0.0;
+    for (Size i=0; i<bonds.size() && i<portfolio.size(); ++i) {
+        bonds[i]->setPricingEngine(engine);
+        Real flat = portfolio.npv(i, discountNodes, forecastNodes) /
+                    portfolio.scale[i];
+        error = std::max(error, std::fabs(flat - bonds[i]->NPV()));
+    }
+    return error;
+}
+
+
+/************************
+ ***  SHARDED PRICING ***
+ ************************/
+
+// Layout of the shared-memory segment: a read-only part holding the
+// curve nodes, followed by a page-aligned writable part where the
+// workers store their results.
+struct ShardReport {
+    double seconds;
+    long residentGrowthKb;
+    int node, cpu;
+    std::uint64_t positions;
+    std::uint64_t done;
+};
+
+struct SharedSegmentLayout {
+    Size discountNodes, forecastNodes, positions, shards;
+    Size discountTimes, discountLogs, forecastTimes, forecastLogs;
+    Size curveBytes, results, reports, bytes;
+    SharedSegmentLayout(Size discountNodes, Size forecastNodes,
+                        Size positions, Size shards)
+    : discountNodes(discountNodes), forecastNodes(forecastNodes),
+      positions(positions), shards(shards) {
+        Size page = Size(::sysconf(_SC_PAGESIZE));
+        discountTimes = 0;
+        discountLogs = discountTimes + discountNodes * sizeof(Real);
+        forecastTimes = discountLogs + discountNodes * sizeof(Real);
+        forecastLogs = forecastTimes + forecastNodes * sizeof(Real);
+        curveBytes = forecastLogs + forecastNodes * sizeof(Real);
+        results = (curveBytes + page - 1) / page * page;
+        reports = results + positions * sizeof(Real);
+        bytes = reports + shards * sizeof(ShardReport);
+    }
+};
+
+// NUMA nodes and their CPUs as listed by sysfs; a single node holding
+// every available CPU if the information is not there.
+std::vector<std::vector<int> > numaNodeCpus() {
+    std::vector<std::vector<int> > nodes;
+    for (int n=0; ; ++n) {
+        std::ifstream in("/sys/devices/system/node/node" +
+                         std::to_string(n) + "/cpulist");
+        if (!in)
+            break;
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first = 0, last = 0;
+            int read = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (read == 1)
+                last = first;
+            for (int c=first; read>=1 && c<=last; ++c)
+                cpus.push_back(c);
+        }
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        for (int c=0; c<int(std::thread::hardware_concurrency()); ++c)
+            cpus.push_back(c);
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+// Body of a worker process: attaches to the segment, prices its
+// partition of the portfolio and writes the results back.
+void runPricingShard(const std::string& segmentName,
+                     const SharedSegmentLayout& layout,
+                     const FlatPortfolio& portfolio,
+                     Size shard, int node, int cpu, Size iterations) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    ::sched_setaffinity(0, sizeof(cpus), &cpus);
+
+    int fd = ::shm_open(segmentName.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        ::_exit(2);
+    void* curves = ::mmap(nullptr, layout.curveBytes, PROT_READ,
+                          MAP_SHARED, fd, 0);
+    void* output = ::mmap(nullptr, layout.bytes - layout.results,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                          off_t(layout.results));
+    ::close(fd);
+    if (curves == MAP_FAILED || output == MAP_FAILED)
+        ::_exit(3);
+
+    const char* c = static_cast<const char*>(curves);
+    DiscountCurveView discountCurve = {
+        reinterpret_cast<const Time*>(c + layout.discountTimes),
+        reinterpret_cast<const Real*>(c + layout.discountLogs),
+        layout.discountNodes
+    };
+    DiscountCurveView forecastCurve = {
+        reinterpret_cast<const Time*>(c + layout.forecastTimes),
+        reinterpret_cast<const Real*>(c + layout.forecastLogs),
+        layout.forecastNodes
+    };
+    char* o = static_cast<char*>(output);
+    Real* npvs = reinterpret_cast<Real*>(o);
+    ShardReport* report = reinterpret_cast<ShardReport*>(
+                                        o + (layout.reports - layout.results));
+
+    Size first = shard * portfolio.size() / layout.shards;
+    Size last = (shard + 1) * portfolio.size() / layout.shards;
+    // a forked worker inherits the coordinator's resident pages and
+    // high-water mark, so only the growth during pricing is its own
+    long residentBefore = residentKb();
+    auto start = std::chrono::steady_clock::now();
+    for (Size it=0; it<iterations; ++it)
+        for (Size i=first; i<last; ++i)
+            npvs[i] = portfolio.npv(i, discountCurve, forecastCurve);
+    report[shard].seconds = secondsSince(start);
+    long residentAfter = residentKb();
+    report[shard].residentGrowthKb =
+        residentBefore >= 0 && residentAfter >= 0 ?
+        residentAfter - residentBefore : -1;
+    report[shard].node = node;
+    report[shard].cpu = ::sched_getcpu();
+    report[shard].positions = last - first;
+    report[shard].done = 1;
+    ::_exit(0);
+}
+
+// Publishes the curve nodes in a POSIX shared-memory segment, forks one
+// worker per shard and gathers the results; returns the wall time.
+double priceSharded(const CurveNodes& discountNodes,
+                    const CurveNodes& forecastNodes,
+                    const FlatPortfolio& portfolio,
+                    Size shards, Size iterations,
+                    std::vector<Real>& npvs,
+                    std::vector<ShardReport>& reports) {
+    SharedSegmentLayout layout(discountNodes.times.size(),
+                               forecastNodes.times.size(),
+                               portfolio.size(), shards);
+    std::string name = "/bonds2-" + std::to_string(::getpid());
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    QL_REQUIRE(fd >= 0, "unable to create shared segment " << name);
+    if (::ftruncate(fd, off_t(layout.bytes)) != 0) {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        QL_FAIL("unable to size shared segment " << name);
+    }
+    void* segment = ::mmap(nullptr, layout.bytes, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        QL_FAIL("unable to map shared segment " << name);
+    }
+    char* s = static_cast<char*>(segment);
+    std::memcpy(s + layout.discountTimes, discountNodes.times.data(),
+                layout.discountNodes * sizeof(Real));
+    std::memcpy(s + layout.discountLogs, discountNodes.logDiscounts.data(),
+                layout.discountNodes * sizeof(Real));
+    std::memcpy(s + layout.forecastTimes, forecastNodes.times.data(),
+                layout.forecastNodes * sizeof(Real));
+    std::memcpy(s + layout.forecastLogs, forecastNodes.logDiscounts.data(),
+                layout.forecastNodes * sizeof(Real));
+
+    std::vector<std::vector<int> > nodes = numaNodeCpus();
+    std::cout.flush();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> workers;
+    for (Size k=0; k<shards; ++k) {
+        // consecutive shards go to different NUMA nodes
+        int node = int(k % nodes.size());
+        const std::vector<int>& cpus = nodes[node];
+        int cpu = cpus[(k / nodes.size()) % cpus.size()];
+        pid_t pid = ::fork();
+        if (pid == 0)
+            runPricingShard(name, layout, portfolio, k, node, cpu,
+                            iterations);
+        if (pid > 0)
+            workers.push_back(pid);
+    }
+    bool failed = workers.size() != shards;
+    for (pid_t pid : workers) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    double elapsed = secondsSince(start);
+
+    const Real* results = reinterpret_cast<const Real*>(s + layout.results);
+    npvs.assign(results, results + portfolio.size());
+    const ShardReport* r =
+        reinterpret_cast<const ShardReport*>(s + layout.reports);
+    reports.assign(r, r + shards);
+    for (const auto& report : reports)
+        failed = failed || report.done != 1;
+    ::munmap(segment, layout.bytes);
+    ::shm_unlink(name.c_str());
+    QL_REQUIRE(!failed, "pricing shard failed");
+    return elapsed;
+}
+
+void benchmarkShardedPricing(const FlatPortfolio& portfolio,
+                             const CurveNodes& discountNodes,
+                             const CurveNodes& forecastNodes,
+                             Size shards, Size iterations) {
+    // single-process reference on the coordinator's own copy
+    DiscountCurveView discountCurve = discountNodes.view();
+    DiscountCurveView forecastCurve = forecastNodes.view();
+    std::vector<Real> reference(portfolio.size());
+    auto start = std::chrono::steady_clock::now();
+    for (Size it=0; it<iterations; ++it)
+        for (Size i=0; i<portfolio.size(); ++i)
+            reference[i] = portfolio.npv(i, discountCurve, forecastCurve);
+    double serial = secondsSince(start);
+
+    std::cout << std::endl;
+    std::cout << "Sharded pricing benchmark: " << portfolio.size()
+              << " positions x " << iterations << " iterations, "
+              << numaNodeCpus().size() << " NUMA node(s)" << std::endl;
+    std::cout << std::setprecision(3)
+              << "  in-process: " << serial << " s" << std::endl;
+
+    std::vector<Size> counts(1, 1);
+    if (shards > 1)
+        counts.push_back(shards);
+    for (Size n : counts) {
+        std::vector<Real> npvs;
+        std::vector<ShardReport> reports;
+        double elapsed = priceSharded(discountNodes, forecastNodes,
+                                      portfolio, n, iterations,
+                                      npvs, reports);
+        Real maxDifference = 0.0;
+        for (Size i=0; i<npvs.size(); ++i)
+            maxDifference = std::max(maxDifference,
+                                     std::fabs(npvs[i] - reference[i]));
+        std::cout << std::setprecision(3)
+                  << "  " << n << " shard(s): " << elapsed << " s, speed-up "
+                  << serial / elapsed << "x, max NPV difference "
+                  << std::scientific << maxDifference << std::fixed
+                  << std::endl;
+        for (Size k=0; k<n; ++k)
+            std::cout << "    shard " << k << ": node " << reports[k].node
+                      << ", cpu " << reports[k].cpu << ", "
+                      << reports[k].positions << " positions, "
+                      << reports[k].seconds << " s, RSS growth "
+                      << reports[k].residentGrowthKb << " kB" << std::endl;
+    }
+}
+
+
+
+/***********************
+ ***  COMPACT LOANS  ***
+ ***********************/
+
+//! Compact storage for the schedules and amortization rows of many loans
+/*! Payment dates are kept as the serial number of the first date plus
+    16-bit day increments, pooled for all loans.  The interest,
+    principal and outstanding balance of each loan are stored as three
+    columns padded to 32-byte blocks, so that every column starts on
+    an aligned address and can be swept with vector loads.
+*/
+class CompactLoanBook {
+  public:
+    //! appends a loan; the rows refer to the periods between dates
+    Size add(const Schedule& schedule,
+             const std::vector<Real>& interest,
+             const std::vector<Real>& principal,
+             const std::vector<Real>& balance) {
+        Size n = schedule.size() - 1;
+        QL_REQUIRE(n > 0 && n <= 0xFFFF, "unsupported number of periods");
+        QL_REQUIRE(interest.size() == n && principal.size() == n &&
+                   balance.size() == n, "mismatched amortization rows");
+        firstSerials_.push_back(
+            std::int32_t(schedule.date(0).serialNumber()));
+        periods_.push_back(std::uint16_t(n));
+        deltaOffsets_.push_back(deltas_.size());
+        for (Size i=1; i<=n; ++i) {
+            Date::serial_type delta = schedule.date(i) - schedule.date(i-1);
+            QL_REQUIRE(delta >= 0 && delta <= 0xFFFF,
+                       "schedule dates too far apart");
+            deltas_.push_back(std::uint16_t(delta));
+        }
+        Size blocks = (n + blockSize - 1) / blockSize;
+        rowOffsets_.push_back(rows_.size());
+        rows_.resize(rows_.size() + 3 * blocks);
+        Real* r = rows(size() - 1);
+        std::copy(interest.begin(), interest.end(), r);
+        std::copy(principal.begin(), principal.end(), r + blocks * blockSize);
+        std::copy(balance.begin(), balance.end(), r + 2 * blocks * blockSize);
+        return size() - 1;
+    }
+    Size size() const { return firstSerials_.size(); }
+    Size periods(Size loan) const { return periods_[loan]; }
+    Date::serial_type firstSerial(Size loan) const {
+        return firstSerials_[loan];
+    }
+    //! day increments between consecutive dates of the loan
+    const std::uint16_t* deltas(Size loan) const {
+        return deltas_.data() + deltaOffsets_[loan];
+    }
+    const Real* interest(Size loan) const { return rows(loan); }
+    const Real* principal(Size loan) const {
+        return rows(loan) + blocks(loan) * blockSize;
+    }
+    const Real* balance(Size loan) const {
+        return rows(loan) + 2 * blocks(loan) * blockSize;
+    }
+    //! decoded payment dates, excluding the start date
+    std::vector<Date> paymentDates(Size loan) const {
+        std::vector<Date> dates;
+        dates.reserve(periods(loan));
+        Date::serial_type serial = firstSerial(loan);
+        const std::uint16_t* d = deltas(loan);
+        for (Size i=0; i<periods(loan); ++i) {
+            serial += d[i];
+            dates.push_back(Date(serial));
+        }
+        return dates;
+    }
+    void shrinkToFit() {
+        firstSerials_.shrink_to_fit();
+        periods_.shrink_to_fit();
+        deltaOffsets_.shrink_to_fit();
+        rowOffsets_.shrink_to_fit();
+        deltas_.shrink_to_fit();
+        rows_.shrink_to_fit();
+    }
+    Size bytes() const {
+        return firstSerials_.capacity() * sizeof(std::int32_t)
+             + periods_.capacity() * sizeof(std::uint16_t)
+             + deltaOffsets_.capacity() * sizeof(Size)
+             + rowOffsets_.capacity() * sizeof(Size)
+             + deltas_.capacity() * sizeof(std::uint16_t)
+             + rows_.capacity() * sizeof(RowBlock);
+    }
+  private:
+    static constexpr Size blockSize = 4;
+    struct alignas(32) RowBlock { Real values[blockSize]; };
+    Size blocks(Size loan) const {
+        return (periods_[loan] + blockSize - 1) / blockSize;
+    }
+    Real* rows(Size loan) {
+        return reinterpret_cast<Real*>(rows_.data() + rowOffsets_[loan]);
+    }
+    const Real* rows(Size loan) const {
+        return reinterpret_cast<const Real*>(rows_.data() + rowOffsets_[loan]);
+    }
+    std::vector<std::int32_t> firstSerials_;
+    std::vector<std::uint16_t> periods_;
+    std::vector<Size> deltaOffsets_, rowOffsets_;
+    std::vector<std::uint16_t> deltas_;
+    std::vector<RowBlock> rows_;
+};
+
+// Interest, principal and outstanding balance of a level-payment loan;
+// the rows are reserved up front, as in the amortization table of the
+// example, so that the vectors carry no growth slack.
+void annuityRows(Real faceAmount, Rate rate, Size periods,
+                 std::vector<Real>& interest,
+                 std::vector<Real>& principal,
+                 std::vector<Real>& balance) {
+    interest.reserve(interest.size() + periods);
+    principal.reserve(principal.size() + periods);
+    balance.reserve(balance.size() + periods);
+    Rate r = rate / 12.0;
+    Real payment = faceAmount * r / (1.0 - std::pow(1.0 + r, -Real(periods)));
+    Real outstanding = faceAmount;
+    for (Size i=0; i<periods; ++i) {
+        Real paidInterest = outstanding * r;
+        outstanding -= payment - paidInterest;
+        interest.push_back(paidInterest);
+        principal.push_back(payment - paidInterest);
+        balance.push_back(outstanding);
+    }
+}
+
+// Stores the same monthly loans as Schedule objects plus row vectors
+// and as a CompactLoanBook, and values them on a daily discount grid.
+void benchmarkCompactLoans(const Handle<YieldTermStructure>& curve,
+                           Size numberOfLoans, Size iterations) {
+    Date referenceDate = curve->referenceDate();
+    Calendar calendar = Israel();
+
+    struct Loan {
+        Schedule schedule;
+        std::vector<Real> interest, principal, balance;
+    };
+    std::vector<Loan> loans;
+    loans.reserve(numberOfLoans);
+    CompactLoanBook book;
+    for (Size i=0; i<numberOfLoans; ++i) {
+        Date start = referenceDate - Period(Integer(i % 24), Months)
+                                   + Integer(i % 28);
+        Schedule schedule(start, start + Period(20, Years), Period(Monthly),
+                          calendar, Following, Following,
+                          DateGeneration::Forward, false);
+        Loan loan = { schedule, {}, {}, {} };
+        annuityRows(100.0, 0.03 + 0.0025 * Real(i % 13),
+                    schedule.size() - 1,
+                    loan.interest, loan.principal, loan.balance);
+        book.add(loan.schedule, loan.interest, loan.principal, loan.balance);
+        loans.push_back(std::move(loan));
+    }
+    book.shrinkToFit();
+
+    Size loanBytes = 0;
+    for (const auto& loan : loans)
+        loanBytes += sizeof(Loan)
+            + loan.schedule.dates().capacity() * sizeof(Date)
+            + (loan.interest.capacity() + loan.principal.capacity()
+               + loan.balance.capacity()) * sizeof(Real);
+
+    // daily discount factors, so that both layouts pay the same
+    // (array lookup) cost for discounting
+    Date horizon = referenceDate + Period(22, Years);
+    std::vector<DiscountFactor> daily(Size(horizon - referenceDate) + 1);
+    for (Size k=0; k<daily.size(); ++k)
+        daily[k] = curve->discount(referenceDate + Integer(k), true);
+    Date::serial_type today = referenceDate.serialNumber();
+
+    std::vector<Real> npvs[2];
+    npvs[0].resize(loans.size());
+    npvs[1].resize(loans.size());
+    auto start = std::chrono::steady_clock::now();
+    for (Size it=0; it<iterations; ++it) {
+        for (Size i=0; i<loans.size(); ++i) {
+            const Loan& loan = loans[i];
+            Real npv = 0.0;
+            for (Size j=1; j<loan.schedule.size(); ++j) {
+                Date::serial_type k = loan.schedule[j].serialNumber() - today;
+                if (k > 0)
+                    npv += (loan.interest[j-1] + loan.principal[j-1]) *
+                           daily[k];
+            }
+            npvs[0][i] = npv;
+        }
+    }
+    double vectorTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (Size it=0; it<iterations; ++it) {
+        for (Size i=0; i<book.size(); ++i) {
+            const std::uint16_t* deltas = book.deltas(i);
+            const Real* interest = book.interest(i);
+            const Real* principal = book.principal(i);
+            Date::serial_type k = book.firstSerial(i) - today;
+            Real npv = 0.0;
+            for (Size j=0; j<book.periods(i); ++j) {
+                k += deltas[j];
+                if (k > 0)
+                    npv += (interest[j] + principal[j]) * daily[k];
+            }
+            npvs[1][i] = npv;
+        }
+    }
+    double compactTime = secondsSince(start);
+
+    Real maxDifference = 0.0;
+    for (Size i=0; i<loans.size(); ++i)
+        maxDifference = std::max(maxDifference,
+                                 std::fabs(npvs[0][i] - npvs[1][i]));
+
+    Size valuations = loans.size() * iterations;
+    std::cout << std::endl;
+    std::cout << "Compact loan storage benchmark: " << loans.size()
+              << " loans x 240 periods, " << iterations << " iterations"
+              << std::endl;
+    std::cout << std::setprecision(0)
+              << "  bytes/loan: Schedule + vectors "
+              << Real(loanBytes) / loans.size()
+              << ", compact " << Real(book.bytes()) / book.size() << std::endl;
+    std::cout << "  loans/s: Schedule + vectors "
+              << Real(valuations) / vectorTime
+              << ", compact " << Real(valuations) / compactTime << std::endl;
+    std::cout << std::scientific << std::setprecision(2)
+              << "  max NPV difference: " << maxDifference
+              << std::fixed << std::endl;
+}
+
+
+/*************************
+ ***  CALLABLE LATTICE ***
+ *************************/
+
+//! Cash flows and call dates of a bond, in times on a given curve
+struct LatticeBond {
+    std::vector<std::pair<Time, Real> > cashflows;
+    //! time and amount paid by the issuer if the bond is called then
+    std::vector<std::pair<Time, Real> > calls;
+};
+
+LatticeBond latticeBond(const Bond& bond, const CallabilitySchedule& calls,
+                        const YieldTermStructure& curve) {
+    LatticeBond result;
+    Date referenceDate = curve.referenceDate();
+    for (const auto& cf : bond.cashflows()) {
+        if (!cf->hasOccurred(referenceDate, false))
+            result.cashflows.emplace_back(
+                curve.timeFromReference(cf->date()), cf->amount());
+    }
+    for (const auto& call : calls) {
+        QL_REQUIRE(call->type() == Callability::Call,
+                   "only calls are supported");
+        QL_REQUIRE(call->price().type() == Bond::Price::Clean,
+                   "clean call prices required");
+        Date d = call->date();
+        if (d > referenceDate)
+            // dirty amount on the outstanding notional once the flows
+            // of the day are paid; nothing is accrued on coupon dates
+            result.calls.emplace_back(curve.timeFromReference(d),
+                                      (call->price().amount() +
+                                       bond.accruedAmount(d)) / 100.0 *
+                                      bond.notional(d));
+    }
+    return result;
+}
+
+//! Backward induction of many callable bonds on one short-rate tree
+/*! The tree of the model is built once on a grid including the cash
+    flow and call times of all bonds, and flattened into per-node
+    arrays of discounts, branch probabilities and first descendants.
+    Values are laid out with the bonds of a block contiguous for each
+    node, so that every rollback step is a sweep over contiguous
+    arrays; blocks of bonds are priced in parallel on the same tree.
+    Call amounts include the accrued interest: the issuer calls when
+    the continuation value exceeds the call amount, before the flows
+    of the day are paid.
+*/
+class BatchShortRateLattice {
+  public:
+    BatchShortRateLattice(const ext::shared_ptr<OneFactorModel>& model,
+                          const std::vector<LatticeBond>& bonds,
+                          Size timeSteps) {
+        std::vector<Time> times;
+        for (const auto& bond : bonds) {
+            for (const auto& cf : bond.cashflows)
+                times.push_back(cf.first);
+            for (const auto& call : bond.calls)
+                times.push_back(call.first);
+        }
+        QL_REQUIRE(!times.empty(), "no cash flows to price");
+        grid_ = TimeGrid(times.begin(), times.end(), timeSteps);
+        ext::shared_ptr<OneFactorModel::ShortRateTree> tree =
+            ext::dynamic_pointer_cast<OneFactorModel::ShortRateTree>(
+                                                      model->tree(grid_));
+        QL_REQUIRE(tree, "short-rate tree required");
+        Size steps = grid_.size() - 1;
+        offsets_.resize(steps + 2, 0);
+        for (Size i=0; i<=steps; ++i)
+            offsets_[i+1] = offsets_[i] + tree->size(i);
+        Size nodes = offsets_[steps];
+        descendants_.resize(nodes);
+        discounts_.resize(nodes);
+        p0_.resize(nodes);
+        p1_.resize(nodes);
+        p2_.resize(nodes);
+        for (Size i=0; i<steps; ++i) {
+            for (Size j=0; j<tree->size(i); ++j) {
+                Size k = offsets_[i] + j;
+                descendants_[k] = tree->descendant(i, j, 0);
+                discounts_[k] = tree->discount(i, j);
+                p0_[k] = tree->probability(i, j, 0);
+                p1_[k] = tree->probability(i, j, 1);
+                p2_[k] = tree->probability(i, j, 2);
+            }
+        }
+    }
+    Size timeSteps() const { return grid_.size() - 1; }
+
+    //! prices the bonds in [first, last) and writes their values
+    void rollback(const std::vector<LatticeBond>& bonds,
+                  Size first, Size last, Real* npvs) const {
+        const Size width = last - first, steps = timeSteps();
+        struct Event {
+            Size bond;
+            Real amount;
+            bool call;
+        };
+        std::vector<std::vector<Event> > events(steps + 1);
+        for (Size b=0; b<width; ++b) {
+            for (const auto& cf : bonds[first+b].cashflows)
+                events[grid_.index(cf.first)].push_back({ b, cf.second, false });
+            for (const auto& call : bonds[first+b].calls)
+                events[grid_.index(call.first)].push_back(
+                                                { b, call.second, true });
+        }
+        for (auto& e : events)
+            // calls before flows, see the class documentation
+            std::stable_partition(e.begin(), e.end(),
+                                  [](const Event& x) { return x.call; });
+
+        Size maxNodes = 0;
+        for (Size i=0; i<=steps; ++i)
+            maxNodes = std::max(maxNodes, offsets_[i+1] - offsets_[i]);
+        std::vector<Real> next(maxNodes * width, 0.0), current(maxNodes * width);
+
+        applyEvents(events[steps], next.data(), nodes(steps), width);
+        for (Size i=steps; i-- > 0; ) {
+            Size n = nodes(i);
+            for (Size j=0; j<n; ++j) {
+                Size k = offsets_[i] + j;
+                const Real d = discounts_[k];
+                const Real q0 = p0_[k], q1 = p1_[k], q2 = p2_[k];
+                const Real* v = next.data() + descendants_[k] * width;
+                Real* c = current.data() + j * width;
+                for (Size b=0; b<width; ++b)
+                    c[b] = d * (q0 * v[b] + q1 * v[b + width]
+                                + q2 * v[b + 2 * width]);
+            }
+            applyEvents(events[i], current.data(), n, width);
+            std::swap(next, current);
+        }
+        std::copy(next.begin(), next.begin() + width, npvs + first);
+    }
+
+    //! prices all bonds, blockSize at a time, on the given number of threads
+    std::vector<Real> price(const std::vector<LatticeBond>& bonds,
+                            Size threads, Size blockSize = 64) const {
+        QL_REQUIRE(threads > 0, "at least one thread required");
+        QL_REQUIRE(blockSize > 0, "positive block size required");
+        std::vector<Real> npvs(bonds.size());
+        Size blocks = (bonds.size() + blockSize - 1) / blockSize;
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (Size t=0; t<threads; ++t) {
+            workers.emplace_back([&, t]() {
+                try {
+                    for (Size k=t; k<blocks; k+=threads)
+                        rollback(bonds, k * blockSize,
+                                 std::min(bonds.size(), (k + 1) * blockSize),
+                                 npvs.data());
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        for (const auto& e : errors)
+            if (e)
+                std::rethrow_exception(e);
+        return npvs;
+    }
+  private:
+    Size nodes(Size i) const { return offsets_[i+1] - offsets_[i]; }
+    template <class Events>
+    static void applyEvents(const Events& events, Real* values,
+                            Size nodes, Size width) {
+        for (const auto& e : events) {
+            Real* v = values + e.bond;
+            if (e.call) {
+                for (Size j=0; j<nodes; ++j)
+                    v[j * width] = std::min(v[j * width], e.amount);
+            } else {
+                for (Size j=0; j<nodes; ++j)
+                    v[j * width] += e.amount;
+            }
+        }
+    }
+    TimeGrid grid_;
+    std::vector<Size> offsets_, descendants_;
+    std::vector<Real> discounts_, p0_, p1_, p2_;
+};
+
+// Calls at par on every coupon date from the given date on.
+CallabilitySchedule parCalls(const Bond& bond, const Date& firstCall) {
+    CallabilitySchedule calls;
+    for (const auto& cf : bond.cashflows()) {
+        Date d = cf->date();
+        if (d >= firstCall && d < bond.maturityDate() &&
+            ext::dynamic_pointer_cast<Coupon>(cf) &&
+            (calls.empty() || calls.back()->date() != d))
+            calls.push_back(ext::make_shared<Callability>(
+                Bond::Price(100.0, Bond::Price::Clean),
+                Callability::Call, d));
+    }
+    return calls;
+}
+
+// Prices callable bullet bonds with QuantLib's tree engine and with the
+// batch lattice on the same Hull-White model, then callable amortizing
+// bonds with the batch lattice alone.
+void benchmarkCallableLattice(const Handle<YieldTermStructure>& curve,
+                              const std::vector<ext::shared_ptr<Bond> >& amortizing,
+                              const Date& settlementDate,
+                              Natural settlementDays,
+                              Size numberOfBonds, Size timeSteps,
+                              Size threads) {
+    ext::shared_ptr<HullWhite> model(new HullWhite(curve, 0.03, 0.01));
+    ext::shared_ptr<PricingEngine> treeEngine(
+        new TreeCallableFixedRateBondEngine(model, timeSteps, curve));
+
+    std::vector<LatticeBond> bullets;
+    std::vector<ext::shared_ptr<CallableFixedRateBond> > callables;
+    for (Size i=0; i<numberOfBonds; ++i) {
+        Date issueDate = settlementDate - Period(Integer(i % 12), Months);
+        Rate coupon = 0.04 + 0.0025 * Real(i % 9);
+        Schedule schedule(issueDate,
+                          issueDate + Period(5 + Integer(i % 11), Years),
+                          Period(Semiannual), UnitedStates(UnitedStates::GovernmentBond),
+                          Unadjusted, Unadjusted,
+                          DateGeneration::Backward, false);
+        FixedRateBond bond(settlementDays, 100.0, schedule,
+                           std::vector<Rate>(1, coupon),
+                           ActualActual(ActualActual::Bond),
+                           Unadjusted, 100.0, issueDate);
+        CallabilitySchedule calls =
+            parCalls(bond, settlementDate + Period(2, Years));
+        callables.push_back(ext::make_shared<CallableFixedRateBond>(
+                settlementDays, 100.0, schedule,
+                std::vector<Rate>(1, coupon),
+                ActualActual(ActualActual::Bond),
+                Unadjusted, 100.0, issueDate, calls));
+        callables.back()->setPricingEngine(treeEngine);
+        bullets.push_back(latticeBond(bond, calls, **curve));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Real> treeNPVs;
+    for (const auto& bond : callables)
+        treeNPVs.push_back(bond->NPV());
+    double treeTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    BatchShortRateLattice bulletLattice(model, bullets, timeSteps);
+    std::vector<Real> batchNPVs = bulletLattice.price(bullets, threads);
+    double batchTime = secondsSince(start);
+
+    Real maxDifference = 0.0;
+    for (Size i=0; i<bullets.size(); ++i)
+        maxDifference = std::max(maxDifference,
+                                 std::fabs(treeNPVs[i] - batchNPVs[i]));
+
+    std::vector<LatticeBond> amortizingBonds;
+    for (const auto& bond : amortizing)
+        amortizingBonds.push_back(latticeBond(
+            *bond, parCalls(*bond, settlementDate + Period(3, Years)),
+            **curve));
+    start = std::chrono::steady_clock::now();
+    BatchShortRateLattice amortizingLattice(model, amortizingBonds, timeSteps);
+    std::vector<Real> amortizingNPVs =
+        amortizingLattice.price(amortizingBonds, threads);
+    double amortizingTime = secondsSince(start);
+
+    std::cout << std::endl;
+    std::cout << "Callable lattice benchmark: Hull-White, "
+              << threads << " thread(s)" << std::endl;
+    // the tree engine builds its own tree of timeSteps steps per bond
+    std::cout << std::setprecision(0)
+              << "  " << bullets.size() << " callable bullets, QuantLib tree ("
+              << timeSteps << " steps): "
+              << Real(bullets.size()) / treeTime << " bonds/s, "
+              << Real(bullets.size() * timeSteps) / treeTime
+              << " bond-steps/s" << std::endl;
+    std::cout << "  " << bullets.size() << " callable bullets, batch lattice ("
+              << bulletLattice.timeSteps() << " steps): "
+              << Real(bullets.size()) / batchTime << " bonds/s, "
+              << Real(bullets.size() * bulletLattice.timeSteps()) / batchTime
+              << " bond-steps/s" << std::endl;
+    std::cout << "  " << amortizingBonds.size()
+              << " callable amortizing, batch lattice ("
+              << amortizingLattice.timeSteps() << " steps): "
+              << Real(amortizingBonds.size()) / amortizingTime << " bonds/s, "
+              << Real(amortizingBonds.size() * amortizingLattice.timeSteps())
+                 / amortizingTime
+              << " bond-steps/s" << std::endl;
+    std::cout << std::setprecision(4)
+              << "  max NPV difference vs QuantLib tree: " << maxDifference
+              << ", first amortizing NPV: " << amortizingNPVs.front()
+              << std::endl;
+}
+
+
+/************************
+ ***  BLACK OPTIONLETS ***
+ ************************/
+
+//! Caplets and floorlets of capped/floored Ibor coupons priced in batch
+/*! Coupons are gathered once into arrays of forwards, effective
+    strikes, standard deviations and weights; the Black formula is then
+    evaluated in branch-free loops over the arrays, which the compiler
+    can vectorize given a vector math library for log and erfc.  Rates
+    agree with BlackIborCouponPricer::capletRate() and floorletRate()
+    up to round-off; fixings in the past are valued at intrinsic value
+    as in the pricer.  Values are discounted, like the pricer's
+    capletPrice() and floorletPrice(), on the forwarding curve of the
+    coupon index.  Only shifted-lognormal volatilities are handled.
+*/
+class BlackOptionletBatch {
+  public:
+    void add(const CappedFlooredCoupon& coupon,
+             const OptionletVolatilityStructure& volatility) {
+        QL_REQUIRE(volatility.volatilityType() == ShiftedLognormal,
+                   "shifted-lognormal volatility required");
+        if (forwards_.empty())
+            displacement_ = volatility.displacement();
+        QL_REQUIRE(volatility.displacement() == displacement_,
+                   "coupons must share the same displacement");
+        const ext::shared_ptr<FloatingRateCoupon>& underlying =
+            coupon.underlying();
+        Date fixingDate = underlying->fixingDate();
+        bool fixed = fixingDate <= Settings::instance().evaluationDate();
+        // the pricer adjusts only in-arrears fixings
+        forwards_.push_back(fixed || !underlying->isInArrears() ?
+                            underlying->indexFixing() :
+                            underlying->adjustedFixing());
+        if (coupon.isCapped()) {
+            Rate strike = coupon.effectiveCap();
+            capStrikes_.push_back(strike);
+            capStdDevs_.push_back(fixed ? 0.0 : std::sqrt(
+                volatility.blackVariance(fixingDate, strike)));
+        } else {
+            // zero intrinsic value, no time value
+            capStrikes_.push_back(QL_MAX_REAL);
+            capStdDevs_.push_back(0.0);
+        }
+        if (coupon.isFloored()) {
+            Rate strike = coupon.effectiveFloor();
+            floorStrikes_.push_back(strike);
+            floorStdDevs_.push_back(fixed ? 0.0 : std::sqrt(
+                volatility.blackVariance(fixingDate, strike)));
+        } else {
+            floorStrikes_.push_back(-displacement_);
+            floorStdDevs_.push_back(0.0);
+        }
+        gearings_.push_back(underlying->gearing());
+        ext::shared_ptr<IborIndex> index =
+            ext::dynamic_pointer_cast<IborIndex>(underlying->index());
+        QL_REQUIRE(index && !index->forwardingTermStructure().empty(),
+                   "Ibor index with forwarding curve required");
+        const YieldTermStructure& rateCurve =
+            **index->forwardingTermStructure();
+        Date paymentDate = coupon.date();
+        weights_.push_back(underlying->nominal() *
+                           underlying->accrualPeriod() *
+                           (paymentDate > rateCurve.referenceDate() ?
+                            rateCurve.discount(paymentDate) : 1.0));
+    }
+    void calculate() {
+        Size n = forwards_.size();
+        capletRates_.resize(n);
+        floorletRates_.resize(n);
+        capletValues_.resize(n);
+        floorletValues_.resize(n);
+        blackRates(1.0, capStrikes_.data(), capStdDevs_.data(),
+                   capletRates_.data());
+        blackRates(-1.0, floorStrikes_.data(), floorStdDevs_.data(),
+                   floorletRates_.data());
+        for (Size i=0; i<n; ++i) {
+            capletRates_[i] *= gearings_[i];
+            floorletRates_[i] *= gearings_[i];
+            capletValues_[i] = capletRates_[i] * weights_[i];
+            floorletValues_[i] = floorletRates_[i] * weights_[i];
+        }
+    }
+    Size size() const { return forwards_.size(); }
+    //! caplet rates, including gearing, as CappedFlooredCoupon uses them
+    const std::vector<Real>& capletRates() const { return capletRates_; }
+    const std::vector<Real>& floorletRates() const { return floorletRates_; }
+    //! caplet values on the coupon nominals, discounted as in the pricer
+    const std::vector<Real>& capletValues() const { return capletValues_; }
+    const std::vector<Real>& floorletValues() const { return floorletValues_; }
+  private:
+    void blackRates(Real omega, const Real* strikes, const Real* stdDevs,
+                    Real* rates) const {
+        const Size n = forwards_.size();
+        const Real* forwards = forwards_.data();
+        const Real shift = displacement_;
+        for (Size i=0; i<n; ++i) {
+            Real f = forwards[i] + shift, k = strikes[i] + shift;
+            Real sd = stdDevs[i];
+            bool black = sd > 0.0 && k > 0.0;
+            Real s = black ? sd : 1.0, x = black ? k : 1.0;
+            Real d1 = std::log(f / x) / s + 0.5 * s, d2 = d1 - s;
+            Real value = omega * (f * 0.5 * std::erfc(-omega * d1 * M_SQRT1_2)
+                                - x * 0.5 * std::erfc(-omega * d2 * M_SQRT1_2));
+            Real intrinsic = std::max(omega * (forwards[i] - strikes[i]), 0.0);
+            rates[i] = black ? value : intrinsic;
+        }
+    }
+    Real displacement_ = 0.0;
+    std::vector<Real> forwards_, capStrikes_, capStdDevs_,
+                      floorStrikes_, floorStdDevs_, gearings_, weights_;
+    std::vector<Real> capletRates_, floorletRates_,
+                      capletValues_, floorletValues_;
+};
+
+// Prices the optionlets of a portfolio of capped/floored floaters and
+// amortizing floaters coupon by coupon with BlackIborCouponPricer and
+// with the batch kernel.
+void benchmarkOptionletBatch(const ext::shared_ptr<IborIndex>& index,
+                             const Date& settlementDate,
+                             Natural settlementDays,
+                             Size numberOfCoupons) {
+    Handle<OptionletVolatilityStructure> volatility(
+        ext::shared_ptr<OptionletVolatilityStructure>(
+            new ConstantOptionletVolatility(settlementDays, TARGET(),
+                                            ModifiedFollowing, 0.20,
+                                            Actual365Fixed())));
+    ext::shared_ptr<BlackIborCouponPricer> pricer(new BlackIborCouponPricer);
+    pricer->setCapletVolatility(volatility);
+
+    std::vector<ext::shared_ptr<Bond> > bonds;
+    Size coupons = 0;
+    for (Size i=0; coupons<numberOfCoupons; ++i) {
+        Schedule schedule(settlementDate, settlementDate + Period(10, Years),
+                          Period(Quarterly), UnitedStates(UnitedStates::NYSE),
+                          ModifiedFollowing, ModifiedFollowing,
+                          DateGeneration::Backward, false);
+        std::vector<Rate> caps(1, 0.05 + 0.005 * Real(i % 5));
+        std::vector<Rate> floors(1, 0.01 + 0.005 * Real(i % 3));
+        std::vector<Spread> spreads(1, 0.0005 * Real(i % 4));
+        if (i % 2 == 0)
+            bonds.push_back(ext::make_shared<FloatingRateBond>(
+                settlementDays, 100.0, schedule, index, Actual360(),
+                ModifiedFollowing, Natural(2), std::vector<Real>(1, 1.0),
+                spreads, caps, floors));
+        else
+            bonds.push_back(ext::make_shared<AmortizingFloatingRateBond>(
+                settlementDays,
+                annuityNotionals(100.0, 0.04, Quarterly, schedule.size()-1),
+                schedule, index, Actual360(), ModifiedFollowing, Natural(2),
+                std::vector<Real>(1, 1.0), spreads, caps, floors));
+        setCouponPricer(bonds.back()->cashflows(), pricer);
+        coupons += schedule.size() - 1;
+    }
+
+    std::vector<ext::shared_ptr<CappedFlooredCoupon> > optionlets;
+    for (const auto& bond : bonds)
+        for (const auto& cf : bond->cashflows()) {
+            ext::shared_ptr<CappedFlooredCoupon> c =
+                ext::dynamic_pointer_cast<CappedFlooredCoupon>(cf);
+            if (c)
+                optionlets.push_back(c);
+        }
+
+    // coupon by coupon, as CappedFlooredCoupon::rate() does
+    std::vector<Real> caplets(optionlets.size()), floorlets(optionlets.size());
+    auto start = std::chrono::steady_clock::now();
+    for (Size i=0; i<optionlets.size(); ++i) {
+        const CappedFlooredCoupon& c = *optionlets[i];
+        pricer->initialize(*c.underlying());
+        caplets[i] = c.isCapped() ? pricer->capletRate(c.effectiveCap()) : 0.0;
+        floorlets[i] =
+            c.isFloored() ? pricer->floorletRate(c.effectiveFloor()) : 0.0;
+    }
+    double perCoupon = secondsSince(start);
+
+    // prices on the coupon nominals, outside the timing
+    std::vector<Real> capletPrices(optionlets.size()),
+                      floorletPrices(optionlets.size());
+    for (Size i=0; i<optionlets.size(); ++i) {
+        const CappedFlooredCoupon& c = *optionlets[i];
+        pricer->initialize(*c.underlying());
+        Real nominal = c.underlying()->nominal();
+        capletPrices[i] = c.isCapped() ?
+            nominal * pricer->capletPrice(c.effectiveCap()) : 0.0;
+        floorletPrices[i] = c.isFloored() ?
+            nominal * pricer->floorletPrice(c.effectiveFloor()) : 0.0;
+    }
+
+    start = std::chrono::steady_clock::now();
+    BlackOptionletBatch batch;
+    for (const auto& c : optionlets)
+        batch.add(*c, **volatility);
+    double gather = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    batch.calculate();
+    double kernel = secondsSince(start);
+
+    Real maxDifference = 0.0, maxPriceDifference = 0.0;
+    Real capValue = 0.0, floorValue = 0.0;
+    for (Size i=0; i<optionlets.size(); ++i) {
+        maxDifference = std::max(maxDifference, std::max(
+            std::fabs(caplets[i] - batch.capletRates()[i]),
+            std::fabs(floorlets[i] - batch.floorletRates()[i])));
+        maxPriceDifference = std::max(maxPriceDifference, std::max(
+            std::fabs(capletPrices[i] - batch.capletValues()[i]),
+            std::fabs(floorletPrices[i] - batch.floorletValues()[i])));
+        capValue += batch.capletValues()[i];
+        floorValue += batch.floorletValues()[i];
+    }
+
+    Size n = optionlets.size();
+    std::cout << std::endl;
+    std::cout << "Black optionlet batch benchmark: " << n
+              << " capped/floored coupons on " << bonds.size() << " bonds"
+              << std::endl;
+    std::cout << std::setprecision(0)
+              << "  coupons/s: per-coupon pricer " << Real(n) / perCoupon
+              << ", batch gather " << Real(n) / gather
+              << ", batch kernel " << Real(n) / kernel
+              << ", batch total " << Real(n) / (gather + kernel) << std::endl;
+    std::cout << std::setprecision(4)
+              << "  caps value " << capValue << ", floors value " << floorValue
+              << std::scientific << std::setprecision(2)
+              << ", max rate difference " << maxDifference
+              << ", max price difference " << maxPriceDifference
+              << std::fixed << std::endl;
+}
+
+
+/************************
+ ***  RESULT CACHING  ***
+ ************************/
+
+inline void hashCombine(std::uint64_t& seed, std::uint64_t value) {
+    // splitmix64 finalizer over the running seed
+    std::uint64_t z = seed + 0x9e3779b97f4a7c15ULL + value;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    seed = z ^ (z >> 31);
+}
+
+inline void hashCombine(std::uint64_t& seed, Real value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    hashCombine(seed, bits);
+}
+
+// identity of an object, not its contents
+inline void hashCombine(std::uint64_t& seed, const void* object) {
+    hashCombine(seed,
+                std::uint64_t(reinterpret_cast<std::uintptr_t>(object)));
+}
+
+inline void hashCombine(std::uint64_t& seed, const std::string& value) {
+    hashCombine(seed, std::uint64_t(std::hash<std::string>()(value)));
+}
+
+//! Hash of the terms of a bond, independent of market data
+/*! Two bonds with the same hash have the same settlement rules and
+    the same cash flows, or the same coupon terms for floating coupons
+    whose amounts depend on a forecasting curve.  Floating coupons also
+    contribute the identity of their pricer and of its caplet
+    volatility as linked when hashing; changes in the values of the
+    volatility are not seen here, see cachedBondResults().
+*/
+std::uint64_t bondContentHash(const Bond& bond) {
+    std::uint64_t seed = 0;
+    hashCombine(seed, std::uint64_t(bond.settlementDays()));
+    hashCombine(seed, bond.calendar().name());
+    hashCombine(seed, std::uint64_t(bond.issueDate().serialNumber()));
+    for (const auto& cf : bond.cashflows()) {
+        hashCombine(seed, std::uint64_t(cf->date().serialNumber()));
+        ext::shared_ptr<Coupon> coupon = ext::dynamic_pointer_cast<Coupon>(cf);
+        if (!coupon) {
+            hashCombine(seed, cf->amount());
+            continue;
+        }
+        hashCombine(seed, coupon->nominal());
+        hashCombine(seed, std::uint64_t(coupon->accrualStartDate().serialNumber()));
+        hashCombine(seed, std::uint64_t(coupon->accrualEndDate().serialNumber()));
+        hashCombine(seed, coupon->dayCounter().name());
+        ext::shared_ptr<FloatingRateCoupon> floating =
+            ext::dynamic_pointer_cast<FloatingRateCoupon>(cf);
+        if (floating) {
+            hashCombine(seed, floating->index()->name());
+            hashCombine(seed, std::uint64_t(floating->fixingDate().serialNumber()));
+            hashCombine(seed, floating->gearing());
+            hashCombine(seed, floating->spread());
+            hashCombine(seed, std::uint64_t(floating->isInArrears()));
+            ext::shared_ptr<FloatingRateCouponPricer> pricer =
+                floating->pricer();
+            hashCombine(seed, static_cast<const void*>(pricer.get()));
+            ext::shared_ptr<IborCouponPricer> iborPricer =
+                ext::dynamic_pointer_cast<IborCouponPricer>(pricer);
+            if (iborPricer && !iborPricer->capletVolatility().empty())
+                hashCombine(seed, static_cast<const void*>(
+                    iborPricer->capletVolatility().currentLink().get()));
+            ext::shared_ptr<CappedFlooredCoupon> capFloor =
+                ext::dynamic_pointer_cast<CappedFlooredCoupon>(cf);
+            if (capFloor) {
+                hashCombine(seed, capFloor->cap());
+                hashCombine(seed, capFloor->floor());
+            }
+        } else {
+            hashCombine(seed, coupon->rate());
+        }
+    }
+    return seed;
+}
+
+//! Counter bumped whenever any of the observed objects changes
+/*! Registering with the handles of the pricing curves is enough to see
+    relinking, curve updates and the quote changes that reach the
+    curves; quotes can also be registered directly.  Versions of
+    different instances are not comparable, so each instance also has
+    an id unique in the process and a hash of the identities of the
+    objects it observes.
+*/
+class StateVersion : public Observer {
+  public:
+    StateVersion() : id_(nextId()), identity_(id_) {}
+    template <class T>
+    void observe(const Handle<T>& h) {
+        observe(ext::shared_ptr<Observable>(h));
+    }
+    void observe(const ext::shared_ptr<Observable>& o) {
+        registerWith(o);
+        hashCombine(identity_, static_cast<const void*>(o.get()));
+    }
+    void update() override { version_.fetch_add(1, std::memory_order_release); }
+    std::uint64_t version() const {
+        return version_.load(std::memory_order_acquire);
+    }
+    std::uint64_t id() const { return id_; }
+    //! hash of the id and of the observed objects
+    std::uint64_t identity() const { return identity_; }
+  private:
+    static std::uint64_t nextId() {
+        static std::atomic<std::uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    std::uint64_t id_, identity_;
+    std::atomic<std::uint64_t> version_{0};
+};
+
+//! Results shown in the pricing table of the example
+struct BondResults {
+    Real npv, cleanPrice, dirtyPrice, accruedAmount, yield;
+};
+
+//! Process-wide bounded cache of bond pricing results
+/*! Entries are keyed by an instrument content hash together with a
+    hash of the observed market state and its version, the pricing
+    engine and the evaluation date (see pricingState()), so that they
+    become unreachable as soon as the state changes and are recycled
+    as new entries come in.  The cache is set-associative
+    with four ways per set and CLOCK eviction approximating LRU.
+    Lookups are lock-free: each slot is guarded by a sequence counter
+    and a lookup racing with a write simply misses.  Insertions are
+    serialized by a mutex.
+
+    \warning setCapacity() clears the cache and must not run
+             concurrently with lookups.
+*/
+class PricingResultCache : public Singleton<PricingResultCache> {
+    friend class Singleton<PricingResultCache>;
+  private:
+    PricingResultCache() { setCapacity(4096); }
+  public:
+    static constexpr Size ways = 4;
+
+    void setCapacity(Size capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sets_ = 1;
+        while (sets_ * ways < capacity)
+            sets_ *= 2;
+        slots_.reset(new Slot[sets_ * ways]);
+        hands_.assign(sets_, 0);
+        resetStatistics();
+    }
+    Size capacity() const { return sets_ * ways; }
+
+    bool find(std::uint64_t instrument, std::uint64_t state,
+              BondResults& results) const {
+        const Slot* set = slots_.get() + setIndex(instrument, state) * ways;
+        for (Size w=0; w<ways; ++w) {
+            const Slot& slot = set[w];
+            std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before == 0 || (before & 1) != 0)
+                continue;
+            std::uint64_t k0 = slot.key[0].load(std::memory_order_relaxed);
+            std::uint64_t k1 = slot.key[1].load(std::memory_order_relaxed);
+            std::uint64_t v[valueCount];
+            for (Size i=0; i<valueCount; ++i)
+                v[i] = slot.values[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != before)
+                continue;
+            if (k0 == instrument && k1 == state) {
+                slot.referenced.store(true, std::memory_order_relaxed);
+                std::memcpy(&results, v, sizeof(results));
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void insert(std::uint64_t instrument, std::uint64_t state,
+                const BondResults& results) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Size s = setIndex(instrument, state);
+        Slot* set = slots_.get() + s * ways;
+        Slot* target = nullptr;
+        for (Size w=0; w<ways && !target; ++w) {
+            std::uint64_t sequence = set[w].sequence.load(std::memory_order_relaxed);
+            if (sequence == 0 ||
+                (set[w].key[0].load(std::memory_order_relaxed) == instrument &&
+                 set[w].key[1].load(std::memory_order_relaxed) == state))
+                target = &set[w];
+        }
+        if (!target) {
+            // second chance for recently read entries
+            for (;;) {
+                Slot& candidate = set[hands_[s]];
+                hands_[s] = (hands_[s] + 1) % ways;
+                if (!candidate.referenced.exchange(false,
+                                                   std::memory_order_relaxed)) {
+                    target = &candidate;
+                    break;
+                }
+            }
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::uint64_t v[valueCount];
+        std::memcpy(v, &results, sizeof(results));
+        std::uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+        target->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        target->key[0].store(instrument, std::memory_order_relaxed);
+        target->key[1].store(state, std::memory_order_relaxed);
+        for (Size i=0; i<valueCount; ++i)
+            target->values[i].store(v[i], std::memory_order_relaxed);
+        target->referenced.store(false, std::memory_order_relaxed);
+        target->sequence.store(sequence + 2, std::memory_order_release);
+        insertions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! \name Statistics
+    //@{
+    std::uint64_t hits() const { return hits_.load(); }
+    std::uint64_t misses() const { return misses_.load(); }
+    std::uint64_t insertions() const { return insertions_.load(); }
+    std::uint64_t evictions() const { return evictions_.load(); }
+    Real hitRate() const {
+        std::uint64_t lookups = hits() + misses();
+        return lookups == 0 ? 0.0 : Real(hits()) / Real(lookups);
+    }
+    void resetStatistics() {
+        hits_ = misses_ = insertions_ = evictions_ = 0;
+    }
+    //@}
+  private:
+    static constexpr Size valueCount = sizeof(BondResults) / sizeof(Real);
+    struct Slot {
+        // zero if never written, odd while being written
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<std::uint64_t> key[2];
+        std::atomic<std::uint64_t> values[valueCount];
+        mutable std::atomic<bool> referenced{false};
+    };
+    Size setIndex(std::uint64_t instrument, std::uint64_t state) const {
+        std::uint64_t h = instrument;
+        hashCombine(h, state);
+        return Size(h & (sets_ - 1));
+    }
+    Size sets_ = 0;
+    std::unique_ptr<Slot[]> slots_;
+    std::vector<Size> hands_;
+    std::mutex mutex_;
+    mutable std::atomic<std::uint64_t> hits_{0}, misses_{0};
+    std::atomic<std::uint64_t> insertions_{0}, evictions_{0};
+};
+
+// Hash of the market state and of the pricing setup a result depends
+// on: the observed objects and their version, the engine and the
+// evaluation date.
+std::uint64_t pricingState(const StateVersion& version,
+                           const PricingEngine& engine) {
+    std::uint64_t seed = version.identity();
+    hashCombine(seed, version.version());
+    hashCombine(seed, static_cast<const void*>(&engine));
+    hashCombine(seed, std::uint64_t(
+        Settings::instance().evaluationDate().serialNumber()));
+    return seed;
+}
+
+//! Pricing-table results of a bond, served from the cache when possible
+/*! The engine must be the one set on the bond, since instruments don't
+    expose it; the version should observe it along with the curves,
+    and with the caplet volatilities of the coupon pricers of floating
+    bonds, which the content hash only identifies.  Results are not
+    stored if the state changed while pricing.
+*/
+BondResults cachedBondResults(const Bond& bond,
+                              const PricingEngine& engine,
+                              std::uint64_t contentHash,
+                              const StateVersion& version) {
+    PricingResultCache& cache = PricingResultCache::instance();
+    std::uint64_t state = pricingState(version, engine);
+    BondResults results;
+    if (!cache.find(contentHash, state, results)) {
+        results.npv = bond.NPV();
+        results.cleanPrice = bond.cleanPrice();
+        results.dirtyPrice = bond.dirtyPrice();
+        results.accruedAmount = bond.accruedAmount();
+        results.yield = bond.yield(Actual360(), Compounded, Annual);
+        if (pricingState(version, engine) == state)
+            cache.insert(contentHash, state, results);
+    }
+    return results;
+}
+
+// Replays a stream of pricing requests over a set of bonds, with a
+// quote tick every so many requests, with and without the cache.
+void benchmarkResultCache(const std::vector<ext::shared_ptr<Bond> >& bonds,
+                          const ext::shared_ptr<PricingEngine>& engine,
+                          const std::vector<Handle<YieldTermStructure> >& curves,
+                          const ext::shared_ptr<SimpleQuote>& tickingQuote,
+                          Size requests, Size requestsPerTick,
+                          Size threads) {
+    QL_REQUIRE(requestsPerTick > 0, "positive number of requests per tick "
+               "required");
+    StateVersion version;
+    for (const auto& curve : curves)
+        version.observe(curve);
+    version.observe(tickingQuote);
+    version.observe(engine);
+    // caplet volatilities of the coupon pricers, see cachedBondResults()
+    std::vector<ext::shared_ptr<IborCouponPricer> > pricers;
+    for (const auto& bond : bonds) {
+        for (const auto& cf : bond->cashflows()) {
+            ext::shared_ptr<FloatingRateCoupon> floating =
+                ext::dynamic_pointer_cast<FloatingRateCoupon>(cf);
+            ext::shared_ptr<IborCouponPricer> pricer = floating ?
+                ext::dynamic_pointer_cast<IborCouponPricer>(floating->pricer()) :
+                ext::shared_ptr<IborCouponPricer>();
+            if (pricer && std::find(pricers.begin(), pricers.end(), pricer)
+                              == pricers.end()) {
+                pricers.push_back(pricer);
+                if (!pricer->capletVolatility().empty())
+                    version.observe(pricer->capletVolatility());
+            }
+        }
+    }
+    std::vector<std::uint64_t> hashes;
+    for (const auto& bond : bonds)
+        hashes.push_back(bondContentHash(*bond));
+
+    PricingResultCache& cache = PricingResultCache::instance();
+    cache.setCapacity(4 * bonds.size());
+    Real baseQuote = tickingQuote->value();
+
+    // requests are skewed towards the first bonds
+    std::vector<Size> stream(requests);
+    unsigned long long seed = 7;
+    for (auto& r : stream) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        Real u = Real(seed >> 11) / Real(1ULL << 53);
+        r = std::min(bonds.size() - 1, Size(u * u * Real(bonds.size())));
+    }
+
+    Real checksum[2] = { 0.0, 0.0 };
+    double elapsed[2];
+    for (Size k=0; k<2; ++k) {
+        tickingQuote->setValue(baseQuote);
+        auto start = std::chrono::steady_clock::now();
+        for (Size i=0; i<stream.size(); ++i) {
+            if (i > 0 && i % requestsPerTick == 0)
+                tickingQuote->setValue(baseQuote +
+                                       0.001 * Real((i / requestsPerTick) % 2));
+            const Bond& bond = *bonds[stream[i]];
+            if (k == 0) {
+                checksum[k] += bond.NPV() + bond.cleanPrice()
+                             + bond.dirtyPrice() + bond.accruedAmount()
+                             + bond.yield(Actual360(), Compounded, Annual);
+            } else {
+                BondResults r = cachedBondResults(bond, *engine,
+                                                  hashes[stream[i]], version);
+                checksum[k] += r.npv + r.cleanPrice + r.dirtyPrice
+                             + r.accruedAmount + r.yield;
+            }
+        }
+        elapsed[k] = secondsSince(start);
+    }
+    tickingQuote->setValue(baseQuote);
+    std::uint64_t hits = cache.hits(), misses = cache.misses();
+    Real hitRate = cache.hitRate();
+    std::uint64_t evictions = cache.evictions();
+
+    // concurrent lock-free lookups on the entries of the current state
+    for (Size i=0; i<bonds.size(); ++i)
+        cachedBondResults(*bonds[i], *engine, hashes[i], version);
+    cache.resetStatistics();
+    std::uint64_t state = pricingState(version, *engine);
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::thread> readers;
+        for (Size t=0; t<threads; ++t) {
+            readers.emplace_back([&, t]() {
+                BondResults r;
+                for (Size i=t; i<stream.size(); i+=threads)
+                    cache.find(hashes[stream[i]], state, r);
+            });
+        }
+        for (auto& r : readers)
+            r.join();
+    }
+    double concurrent = secondsSince(start);
+
+    std::cout << std::endl;
+    std::cout << "Result cache benchmark: " << bonds.size() << " bonds, "
+              << requests << " requests, a tick every " << requestsPerTick
+              << std::endl;
+    std::cout << std::setprecision(0)
+              << "  requests/s: direct " << Real(requests) / elapsed[0]
+              << ", cached " << Real(requests) / elapsed[1]
+              << ", lock-free lookups x" << threads << " threads "
+              << Real(requests) / concurrent << std::endl;
+    std::cout << std::setprecision(2)
+              << "  hit rate " << io::percent(hitRate) << " (" << hits
+              << " hits, " << misses << " misses, " << evictions
+              << " evictions), concurrent hit rate "
+              << io::percent(cache.hitRate()) << std::endl;
+    std::cout << std::scientific
+              << "  checksum difference: "
+              << std::fabs(checksum[0] - checksum[1])
+              << std::fixed << std::endl;
+}
+
+
+/********************
+ ***  REGRESSION  ***
+ ********************/
+
+// With --record the example stores its golden outputs and benchmark
+// throughputs in text files, refusing to replace existing ones unless
+// --force is also given; with --regression it checks the outputs
+// against the golden values and fails on throughput regressions.  Both
+// fix today's date so that the amortization table is reproducible.
+
+// Yields are solved to this accuracy, well within the tolerance of the
+// golden values, so that they don't depend on the solver's path.
+const Real regressionYieldAccuracy = 1.0e-12;
+
+typedef std::vector<std::pair<std::string, Real> > NamedValues;
+
+void writeNamedValues(const std::string& fileName, const NamedValues& values) {
+    std::ofstream out(fileName.c_str());
+    QL_REQUIRE(out, "unable to write " << fileName);
+    out << std::setprecision(17);
+    for (const auto& v : values)
+        out << v.first << " " << v.second << "\n";
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+std::map<std::string, Real> readNamedValues(const std::string& fileName) {
+    std::ifstream in(fileName.c_str());
+    QL_REQUIRE(in, "unable to read " << fileName
+               << "; create it on a trusted build with --record");
+    std::map<std::string, Real> values;
+    std::string name;
+    Real value;
+    while (in >> name >> value)
+        values[name] = value;
+    return values;
+}
+
+// Discount and compound factors on the schedule dates, with times in
+// years of 365 days from today, and the normalized level coupon of the
+// amortizing bond.
+Real amortizingCouponFactors(const Schedule& schedule, const Date& today,
+                             const InterestRate& rate,
+                             std::vector<Real>& discountFactor,
+                             std::vector<Real>& compoundFactor) {
+    discountFactor.clear();
+    compoundFactor.clear();
+    discountFactor.reserve(schedule.size());
+    compoundFactor.reserve(schedule.size());
+    Real compoundFactorSum = 0.0;
+    Time t = 1.0;
+    for (Size j=0; j<schedule.size(); ++j) {
+        t = Real(schedule[j] - today) / 365;
+        Real a = 1 / rate.compoundFactor(t);
+        discountFactor.push_back(a);
+        compoundFactor.push_back(1 / a);
+        compoundFactorSum += compoundFactor[j];
+    }
+    return rate.compoundFactor(t) / compoundFactorSum;
+}
+
+void recordAmortization(NamedValues& values, const Schedule& schedule,
+                        const std::vector<Real>& discountFactor,
+                        Real normalizedAmortizingCoupon) {
+    for (Size j=0; j<schedule.size(); ++j) {
+        std::string row = "amortization[" + std::to_string(j) + "]";
+        values.emplace_back(row + ".date", Real(schedule[j].serialNumber()));
+        values.emplace_back(row + ".discount", discountFactor[j]);
+    }
+    values.emplace_back("amortization.normalizedCoupon",
+                        normalizedAmortizingCoupon);
+}
+
+void recordCurve(NamedValues& values, const std::string& name,
+                 const ext::shared_ptr<YieldTermStructure>& curve) {
+    ext::shared_ptr<PiecewiseYieldCurve<Discount,LogLinear> > piecewise =
+        ext::dynamic_pointer_cast<PiecewiseYieldCurve<Discount,LogLinear> >(
+                                                                      curve);
+    QL_REQUIRE(piecewise, "log-linear discount curve required");
+    for (const auto& node : piecewise->nodes())
+        values.emplace_back(name + "[" + std::to_string(
+                                node.first.serialNumber()) + "]",
+                            node.second);
+}
+
+void recordBond(NamedValues& values, const std::string& name,
+                const Bond& bond) {
+    values.emplace_back(name + ".npv", bond.NPV());
+    values.emplace_back(name + ".cleanPrice", bond.cleanPrice());
+    values.emplace_back(name + ".dirtyPrice", bond.dirtyPrice());
+    values.emplace_back(name + ".accruedAmount", bond.accruedAmount());
+    values.emplace_back(name + ".yield",
+                        bond.yield(Actual360(), Compounded, Annual,
+                                   regressionYieldAccuracy));
+}
+
+// Throughput of the amortization loop, of the two bootstraps and of the
+// pricing table, in operations per second.
+NamedValues regressionBenchmarks(Size scale,
+                                 const Schedule& schedule, const Date& today,
+                                 const InterestRate& rate,
+                                 const std::vector<ext::shared_ptr<YieldTermStructure> >& curves,
+                                 const std::vector<std::string>& curveNames,
+                                 const std::vector<Bond*>& bonds) {
+    NamedValues throughput;
+    std::vector<Real> discountFactor, compoundFactor;
+    Real sink = 0.0;
+
+    Size n = 2000 * scale;
+    auto start = std::chrono::steady_clock::now();
+    for (Size i=0; i<n; ++i)
+        sink += amortizingCouponFactors(schedule, today, rate,
+                                        discountFactor, compoundFactor);
+    throughput.emplace_back("amortization.tables_per_s",
+                            Real(n) / secondsSince(start));
+
+    n = 20 * scale;
+    for (Size k=0; k<curves.size(); ++k) {
+        ext::shared_ptr<LazyObject> curve =
+            ext::dynamic_pointer_cast<LazyObject>(curves[k]);
+        QL_REQUIRE(curve, "bootstrapped curve required");
+        start = std::chrono::steady_clock::now();
+        for (Size i=0; i<n; ++i) {
+            curve->recalculate();
+            sink += curves[k]->discount(1.0);
+        }
+        throughput.emplace_back("bootstrap." + curveNames[k] + "_per_s",
+                                Real(n) / secondsSince(start));
+    }
+
+    n = 100 * scale;
+    start = std::chrono::steady_clock::now();
+    for (Size i=0; i<n; ++i) {
+        for (Bond* bond : bonds) {
+            bond->recalculate();
+            sink += bond->NPV() + bond->cleanPrice() + bond->dirtyPrice()
+                  + bond->accruedAmount()
+                  + bond->yield(Actual360(), Compounded, Annual,
+                                regressionYieldAccuracy);
+        }
+    }
+    throughput.emplace_back("pricing.tables_per_s",
+                            Real(n) / secondsSince(start));
+
+    QL_ENSURE(sink == sink, "invalid benchmark results");
+    return throughput;
+}
+
+// Returns the number of values differing from the golden ones by more
+// than the relative tolerance, or missing on either side.
+Size checkGolden(const NamedValues& actual, const std::string& fileName,
+                 Real tolerance) {
+    std::map<std::string, Real> golden = readNamedValues(fileName);
+    Size failures = 0;
+    for (const auto& v : actual) {
+        auto expected = golden.find(v.first);
+        if (expected == golden.end()) {
+            std::cout << "  FAIL " << v.first << ": not in golden file"
+                      << std::endl;
+            ++failures;
+            continue;
+        }
+        Real g = expected->second;
+        if (!(std::fabs(v.second - g) <= tolerance * std::max(1.0, std::fabs(g)))) {
+            std::cout << std::setprecision(12)
+                      << "  FAIL " << v.first << ": expected " << g
+                      << ", got " << v.second << std::endl;
+            ++failures;
+        }
+        golden.erase(expected);
+    }
+    for (const auto& g : golden) {
+        std::cout << "  FAIL " << g.first << ": not computed" << std::endl;
+        ++failures;
+    }
+    return failures;
+}
+
+// Returns the number of throughputs below the baseline by more than
+// the given fraction, or missing on either side.
+Size checkBaseline(const NamedValues& actual, const std::string& fileName,
+                   Real threshold) {
+    std::map<std::string, Real> baseline = readNamedValues(fileName);
+    Size failures = 0;
+    for (const auto& v : actual) {
+        auto expected = baseline.find(v.first);
+        if (expected == baseline.end()) {
+            std::cout << "  FAIL " << v.first << ": not in baseline file"
+                      << std::endl;
+            ++failures;
+            continue;
+        }
+        Real ratio = v.second / expected->second;
+        bool failed = ratio < 1.0 - threshold;
+        std::cout << std::setprecision(2)
+                  << "  " << (failed ? "FAIL " : "ok   ") << v.first << ": "
+                  << v.second << " vs " << expected->second << " ("
+                  << io::percent(ratio - 1.0) << ")" << std::endl;
+        if (failed)
+            ++failures;
+        baseline.erase(expected);
+    }
+    for (const auto& b : baseline) {
+        std::cout << "  FAIL " << b.first << ": not measured" << std::endl;
+        ++failures;
+    }
+    return failures;
+}
+
+
+/*******************
+ ***  RISK LADDER ***
+ *******************/
+
+//! Market quote bumped for a key-rate sensitivity
+struct RiskPillar {
+    std::string name;
+    ext::shared_ptr<SimpleQuote> quote;
+    //! quote shift equivalent to one basis point
+    Real shift;
+    //! whether the quote drives the forecasting or the discounting curve
+    bool forecasting;
+};
+
+// Clean-price shift of a bond helper quote that moves the yield of its
+// bond up by one basis point.
+Real basisPointPriceShift(const BondHelper& helper) {
+    const Bond& bond = *helper.bond();
+    Real price = helper.quote()->value();
+    DayCounter dc = ActualActual(ActualActual::Bond);
+    Rate yield = bond.yield(price, dc, Compounded, Semiannual);
+    return bond.cleanPrice(yield + 0.0001, dc, Compounded, Semiannual)
+         - price;
+}
+
+//! Bucketed sensitivities of a flattened portfolio to curve quotes
+/*! The base curves are bootstrapped once on the current quotes; then
+    each pillar is bumped in turn and only the curve it drives is
+    bootstrapped again, exactly once, before its nodes are copied; the
+    quote is then restored, even if the bootstrap fails.  Once all
+    scenarios are available, blocks of positions are priced on
+    parallel threads against every scenario, so that the cash flows of
+    a position are read once for the whole row of the ladder.
+    Sensitivities are NPV changes for the shift of each pillar.
+
+    \warning the curves are left to be bootstrapped again lazily on the
+             restored quotes.
+*/
+class RiskLadder {
+  public:
+    RiskLadder(ext::shared_ptr<YieldTermStructure> discountCurve,
+               ext::shared_ptr<YieldTermStructure> forecastCurve,
+               std::vector<RiskPillar> pillars)
+    : discountCurve_(std::move(discountCurve)),
+      forecastCurve_(std::move(forecastCurve)),
+      pillars_(std::move(pillars)) {}
+
+    Matrix sensitivities(const FlatPortfolio& portfolio, Size threads) {
+        QL_REQUIRE(threads > 0, "at least one thread required");
+        auto start = std::chrono::steady_clock::now();
+        bootstraps_ = 0;
+        CurveNodes baseDiscount = bootstrappedNodes(discountCurve_);
+        CurveNodes baseForecast = bootstrappedNodes(forecastCurve_);
+        std::vector<CurveNodes> scenarios;
+        scenarios.reserve(pillars_.size());
+        for (const auto& pillar : pillars_) {
+            Real value = pillar.quote->value();
+            pillar.quote->setValue(value + pillar.shift);
+            try {
+                scenarios.push_back(bootstrappedNodes(
+                    pillar.forecasting ? forecastCurve_ : discountCurve_));
+            } catch (...) {
+                pillar.quote->setValue(value);
+                throw;
+            }
+            pillar.quote->setValue(value);
+        }
+        bootstrapTime_ = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        const Size n = portfolio.size(), m = pillars_.size();
+        Matrix result(n, m);
+        std::vector<DiscountCurveView> discounts(m, baseDiscount.view()),
+                                       forecasts(m, baseForecast.view());
+        for (Size p=0; p<m; ++p)
+            (pillars_[p].forecasting ? forecasts[p] : discounts[p]) =
+                scenarios[p].view();
+        const Size blockSize = 256;
+        const Size blocks = (n + blockSize - 1) / blockSize;
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (Size t=0; t<threads; ++t) {
+            workers.emplace_back([&, t]() {
+                try {
+                    DiscountCurveView d = baseDiscount.view(),
+                                      f = baseForecast.view();
+                    for (Size k=t; k<blocks; k+=threads) {
+                        Size last = std::min(n, (k + 1) * blockSize);
+                        for (Size i=k*blockSize; i<last; ++i) {
+                            Real base = portfolio.npv(i, d, f);
+                            for (Size p=0; p<m; ++p)
+                                result[i][p] =
+                                    portfolio.npv(i, discounts[p],
+                                                  forecasts[p]) - base;
+                        }
+                    }
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        for (const auto& e : errors)
+            if (e)
+                std::rethrow_exception(e);
+        pricingTime_ = secondsSince(start);
+        return result;
+    }
+    const std::vector<RiskPillar>& pillars() const { return pillars_; }
+    //! curve bootstraps performed by the last ladder
+    Size bootstraps() const { return bootstraps_; }
+    double bootstrapTime() const { return bootstrapTime_; }
+    double pricingTime() const { return pricingTime_; }
+  private:
+    // Forces the bootstrap instead of relying on the curve being
+    // stale, so that every counted bootstrap did run.
+    CurveNodes bootstrappedNodes(
+                          const ext::shared_ptr<YieldTermStructure>& curve) {
+        ext::shared_ptr<LazyObject> lazy =
+            ext::dynamic_pointer_cast<LazyObject>(curve);
+        QL_REQUIRE(lazy, "bootstrapped curve required");
+        lazy->recalculate();
+        ++bootstraps_;
+        return curveNodes(curve);
+    }
+    ext::shared_ptr<YieldTermStructure> discountCurve_, forecastCurve_;
+    std::vector<RiskPillar> pillars_;
+    Size bootstraps_ = 0;
+    double bootstrapTime_ = 0.0, pricingTime_ = 0.0;
+};
+
+void benchmarkRiskLadder(RiskLadder& ladder, const FlatPortfolio& portfolio,
+                         Size threads) {
+    Matrix ladderMatrix = ladder.sensitivities(portfolio, threads);
+    const std::vector<RiskPillar>& pillars = ladder.pillars();
+
+    std::cout << std::endl;
+    std::cout << "Risk ladder: " << portfolio.size() << " positions x "
+              << pillars.size() << " pillars, " << threads << " thread(s)"
+              << std::endl;
+    std::cout << std::setprecision(3)
+              << "  " << ladder.bootstraps() << " bootstraps in "
+              << ladder.bootstrapTime() << " s, pricing in "
+              << ladder.pricingTime() << " s, total "
+              << ladder.bootstrapTime() + ladder.pricingTime() << " s"
+              << std::endl;
+    std::cout << "  portfolio sensitivity per pillar (1bp):" << std::endl;
+    for (Size p=0; p<pillars.size(); ++p) {
+        Real total = 0.0;
+        for (Size i=0; i<ladderMatrix.rows(); ++i)
+            total += ladderMatrix[i][p];
+        std::cout << std::setprecision(4) << "    " << std::setw(14)
+                  << pillars[p].name << std::setw(14) << total << std::endl;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
 
     try {
 
@@ -162,6 +2845,13 @@ int main(int, char* []) {
 
    Date todayDate(day,month,year); //(18, September, 2008);//
 
+   // golden outputs need a reproducible amortization table
+   bool recording = hasOption(argc, argv, "--record");
+   bool regression = hasOption(argc, argv, "--regression");
+   if (recording || regression)
+       todayDate = Date(18, September, 2021);
+   NamedValues golden;
+
    //Date galsDate(boost::posix_time::ptime& localTime);
    //Date todayDate();
 
@@ -288,32 +2978,23 @@ for (int i=0; i< amortizingBondSchdule.size();++i)
         Time t = 1;
         std::cout << interest_rate.compoundFactor(t) <<  endl;
         
-        int size = amortizingBondSchdule.size();
         vector<double> discountFactor;
         vector<double> compoundFactor;
         vector<double> cumulativeInterest;
         vector<double> principalPaid;
         vector<double> loanBalance;
-        
-
-
-
-        double compoundFactorSum=0;
-        double normalizedAmortizingCoupon;
+        double normalizedAmortizingCoupon =
+            amortizingCouponFactors(amortizingBondSchdule, todayDate,
+                                    interest_rate,
+                                    discountFactor, compoundFactor);
         for (int j=0; j < int(amortizingBondSchdule.size());++j)
         {
         /*t = dc_.yearFraction(d1, d2, refStart, refEnd);discountFactor[j] =*/
         t=double(amortizingBondSchdule[j]-todayDate)/365;
-        double a =1/interest_rate.compoundFactor(t);        
-        discountFactor.push_back(a);
-        compoundFactor.push_back(1/a);
-        if(j<int(amortizingBondSchdule.size())) {
-                compoundFactorSum += compoundFactor[j];
-        }       
-        std::cout << amortizingBondSchdule[j] <<"---"<< a <<"---"<< discountFactor[j] <<"---"<< compoundFactor[j]<<"---"<< t << endl;
+        std::cout << amortizingBondSchdule[j] <<"---"<< discountFactor[j] <<"---"<< discountFactor[j] <<"---"<< compoundFactor[j]<<"---"<< t << endl;
         }
-        
-        normalizedAmortizingCoupon=interest_rate.compoundFactor(t)/compoundFactorSum;
+        recordAmortization(golden, amortizingBondSchdule, discountFactor,
+                           normalizedAmortizingCoupon);
 
         std::cout << normalizedAmortizingCoupon << std::endl;
 
@@ -847,6 +3528,178 @@ for (int i=0; i< amortizingBondSchdule.size();++i)
          /* "Yield to Price"
             "Price to Yield" */
 
+         /***************
+          * REGRESSION  *
+          ***************/
+
+         if (recording || regression) {
+             if (recording) {
+                 // don't replace trusted reference values by accident
+                 for (const char* fileName : { "bonds2_golden.txt",
+                                               "bonds2_baseline.txt" })
+                     QL_REQUIRE(hasOption(argc, argv, "--force") ||
+                                !std::ifstream(fileName),
+                                fileName << " already exists; "
+                                "use --force to replace it");
+             }
+             recordCurve(golden, "bondCurve", bondDiscountingTermStructure);
+             recordCurve(golden, "depoSwapCurve", depoSwapTermStructure);
+             recordBond(golden, "zc", zeroCouponBond);
+             recordBond(golden, "fixed", fixedRateBond);
+             recordBond(golden, "floating", floatingRateBond);
+             NamedValues throughput = regressionBenchmarks(
+                 optionValue(argc, argv, "--scale", 1),
+                 amortizingBondSchdule, todayDate, interest_rate,
+                 { bondDiscountingTermStructure, depoSwapTermStructure },
+                 { "bondCurve", "depoSwapCurve" },
+                 { &zeroCouponBond, &fixedRateBond, &floatingRateBond });
+
+             std::cout << std::endl;
+             if (recording) {
+                 writeNamedValues("bonds2_golden.txt", golden);
+                 writeNamedValues("bonds2_baseline.txt", throughput);
+                 std::cout << "Recorded " << golden.size()
+                           << " golden values and " << throughput.size()
+                           << " baselines" << std::endl;
+             } else {
+                 std::cout << "Regression checks:" << std::endl;
+                 Size failures = checkGolden(golden, "bonds2_golden.txt",
+                                             1.0e-10);
+                 failures += checkBaseline(
+                     throughput, "bonds2_baseline.txt",
+                     optionValue(argc, argv, "--threshold", 20) / 100.0);
+                 std::cout << golden.size() << " values, "
+                           << throughput.size() << " benchmarks, "
+                           << failures << " failure(s)" << std::endl;
+                 if (failures > 0)
+                     return 1;
+             }
+         }
+
+         /***************
+          * BENCHMARKS  *
+          ***************/
+
+         if (hasOption(argc, argv, "--bench-discount-cache")) {
+             std::vector<ext::shared_ptr<Bond> > bonds = makeBenchmarkBonds(
+                 optionValue(argc, argv, "--bonds", 1000),
+                 settlementDate, settlementDays);
+             benchmarkDiscountCache(bonds, discountingTermStructure,
+                                    optionValue(argc, argv, "--iterations", 10));
+         }
+
+         if (hasOption(argc, argv, "--bench-fixings")) {
+             benchmarkFixingStore(libor3m, discountingTermStructure,
+                                  settlementDate, settlementDays,
+                                  optionValue(argc, argv, "--lookups", 1000000),
+                                  optionValue(argc, argv, "--threads", 4));
+         }
+
+         if (hasOption(argc, argv, "--bench-sharded")) {
+             std::vector<ext::shared_ptr<Bond> > bonds =
+                 makeBenchmarkPortfolioBonds(settlementDate, settlementDays,
+                                             libor3m);
+             FlatPortfolio portfolio = makeFlatPortfolio(
+                 optionValue(argc, argv, "--positions", 100000), bonds,
+                 **discountingTermStructure, **forecastingTermStructure);
+             CurveNodes discountNodes = curveNodes(bondDiscountingTermStructure);
+             CurveNodes forecastNodes = curveNodes(depoSwapTermStructure);
+             std::cout << std::endl << "Flattened pricing error: "
+                       << std::scientific << maxFlatPricingError(
+                              portfolio, bonds, discountingTermStructure,
+                              discountNodes.view(), forecastNodes.view())
+                       << std::fixed << std::endl;
+             Size cpus = std::max(1U, std::thread::hardware_concurrency());
+             benchmarkShardedPricing(portfolio, discountNodes, forecastNodes,
+                                     optionValue(argc, argv, "--shards", cpus),
+                                     optionValue(argc, argv, "--iterations", 10));
+         }
+
+         if (hasOption(argc, argv, "--bench-compact-loans")) {
+             benchmarkCompactLoans(discountingTermStructure,
+                                   optionValue(argc, argv, "--loans", 10000),
+                                   optionValue(argc, argv, "--iterations", 10));
+         }
+
+         if (hasOption(argc, argv, "--bench-callable")) {
+             Size bonds = optionValue(argc, argv, "--bonds", 1000);
+             benchmarkCallableLattice(
+                 discountingTermStructure,
+                 makeBenchmarkBonds(bonds, settlementDate, settlementDays),
+                 settlementDate, settlementDays, bonds,
+                 optionValue(argc, argv, "--steps", 200),
+                 optionValue(argc, argv, "--threads", 4));
+         }
+
+         if (hasOption(argc, argv, "--bench-optionlets")) {
+             benchmarkOptionletBatch(libor3m,
+                                     settlementDate, settlementDays,
+                                     optionValue(argc, argv, "--coupons",
+                                                 100000));
+         }
+
+         if (hasOption(argc, argv, "--bench-result-cache")) {
+             std::vector<ext::shared_ptr<Bond> > bonds = makeBenchmarkBonds(
+                 optionValue(argc, argv, "--bonds", 100),
+                 settlementDate, settlementDays);
+             for (const auto& bond : bonds)
+                 bond->setPricingEngine(bondEngine);
+             // the bonds of the pricing table above
+             bonds.insert(bonds.begin(), {
+                 ext::shared_ptr<Bond>(&zeroCouponBond, null_deleter()),
+                 ext::shared_ptr<Bond>(&fixedRateBond, null_deleter()),
+                 ext::shared_ptr<Bond>(&floatingRateBond, null_deleter())
+             });
+             std::vector<Handle<YieldTermStructure> > curves = {
+                 discountingTermStructure, forecastingTermStructure,
+                 liborTermStructure
+             };
+             benchmarkResultCache(bonds, bondEngine, curves, quote[0],
+                                  optionValue(argc, argv, "--requests", 100000),
+                                  optionValue(argc, argv, "--tick", 1000),
+                                  optionValue(argc, argv, "--threads", 4));
+         }
+
+         if (hasOption(argc, argv, "--bench-risk-ladder")) {
+             std::vector<RiskPillar> pillars;
+             const char* zcNames[] = { "bond ZC 3M", "bond ZC 6M", "bond ZC 1Y" };
+             ext::shared_ptr<Quote> zcQuotes[] = { zc3mRate, zc6mRate, zc1yRate };
+             for (Size i=0; i<3; ++i)
+                 pillars.push_back({ zcNames[i],
+                     ext::dynamic_pointer_cast<SimpleQuote>(zcQuotes[i]),
+                     0.0001, false });
+             for (Size i=0; i<numberOfBonds; i++) {
+                 std::ostringstream name;
+                 name << "bond " << maturities[i].year();
+                 pillars.push_back({ name.str(), quote[i],
+                     basisPointPriceShift(*bondsHelpers[i]), false });
+             }
+             const char* depoSwapNames[] = {
+                 "depo 1W", "depo 1M", "depo 3M", "depo 6M", "depo 9M",
+                 "depo 1Y", "swap 2Y", "swap 3Y", "swap 5Y", "swap 10Y",
+                 "swap 15Y"
+             };
+             ext::shared_ptr<Quote> depoSwapQuotes[] = {
+                 d1wRate, d1mRate, d3mRate, d6mRate, d9mRate, d1yRate,
+                 s2yRate, s3yRate, s5yRate, s10yRate, s15yRate
+             };
+             for (Size i=0; i<11; ++i)
+                 pillars.push_back({ depoSwapNames[i],
+                     ext::dynamic_pointer_cast<SimpleQuote>(depoSwapQuotes[i]),
+                     0.0001, true });
+
+             std::vector<ext::shared_ptr<Bond> > bonds =
+                 makeBenchmarkPortfolioBonds(settlementDate, settlementDays,
+                                             libor3m);
+             FlatPortfolio portfolio = makeFlatPortfolio(
+                 optionValue(argc, argv, "--positions", 100000), bonds,
+                 **discountingTermStructure, **forecastingTermStructure);
+             RiskLadder ladder(bondDiscountingTermStructure,
+                               depoSwapTermStructure, pillars);
+             benchmarkRiskLadder(ladder, portfolio,
+                                 optionValue(argc, argv, "--threads", 4));
+         }
+
          return 0;
 
     } catch (std::exception& e) {